@@ -0,0 +1,162 @@
+/******************************************************************
+ * The open-loop arrival generator:
+ * arrival_process_from_name - Maps an option value to an arrival process
+ * arrival_setup - Validates the settings and loads the arrival trace
+ * arrival_start - Seeds a producer's generator at the current time
+ * arrival_next - Returns the intended arrival time of the next job
+ * arrival_sleep_until - Sleeps until an absolute monotonic deadline
+ ******************************************************************/
+
+#include "arrival.h"
+#include <vector>
+
+arrival_config arrivals = { ARRIVAL_CLOSED, 1.0, 1000, 4000, 60, 50, NULL };
+
+/* Inter-arrival gaps read from the trace file, in nanoseconds */
+static vector<long long> trace_gaps;
+
+int arrival_process_from_name (const char *name)
+{
+	if (strcmp(name, "closed") == 0)
+		return ARRIVAL_CLOSED;
+	if (strcmp(name, "constant") == 0)
+		return ARRIVAL_CONSTANT;
+	if (strcmp(name, "poisson") == 0)
+		return ARRIVAL_POISSON;
+	if (strcmp(name, "bursty") == 0)
+		return ARRIVAL_BURSTY;
+	if (strcmp(name, "diurnal") == 0)
+		return ARRIVAL_DIURNAL;
+	if (strcmp(name, "trace") == 0)
+		return ARRIVAL_TRACE;
+	return -1;
+}
+
+int arrival_setup ()
+{
+	if (arrivals.process == ARRIVAL_CLOSED)
+		return NO_ERROR;
+
+	if (arrivals.process != ARRIVAL_TRACE && arrivals.rate <= 0)
+	{
+		cerr << "An open-loop arrival process needs a positive rate" << endl;
+		return INVALID_OPTION;
+	}
+	if (arrivals.process == ARRIVAL_BURSTY && (arrivals.burst_on_ms <= 0 || arrivals.burst_off_ms < 0))
+	{
+		cerr << "Bursty arrivals need burst_on_ms > 0 and burst_off_ms >= 0" << endl;
+		return INVALID_OPTION;
+	}
+	if (arrivals.process == ARRIVAL_DIURNAL && (arrivals.diurnal_period_s <= 0 || arrivals.diurnal_amplitude < 0 || arrivals.diurnal_amplitude > 100))
+	{
+		cerr << "Diurnal arrivals need diurnal_period_s > 0 and diurnal_amplitude from 0 to 100" << endl;
+		return INVALID_OPTION;
+	}
+
+	if (arrivals.process == ARRIVAL_TRACE)
+	{
+		double gap_ms;
+		FILE *trace = (arrivals.trace_path != NULL) ? fopen(arrivals.trace_path, "r") : NULL;
+		if (trace == NULL)
+		{
+			cerr << "Unable to read the arrival trace (arrival_trace=<file>)" << endl;
+			return INVALID_OPTION;
+		}
+		while (fscanf(trace, "%lf", &gap_ms) == 1)
+			if (gap_ms >= 0)
+				trace_gaps.push_back((long long) (gap_ms * 1000000.0));
+		fclose(trace);
+		if (trace_gaps.empty())
+		{
+			cerr << "The arrival trace '" << arrivals.trace_path << "' holds no inter-arrival times" << endl;
+			return INVALID_OPTION;
+		}
+	}
+
+	return NO_ERROR;
+}
+
+void arrival_start (arrival_state *state, int producer_id)
+{
+	state->start_ns = state->next_ns = now_ns();
+	state->seed = (unsigned int) (time(NULL) ^ (producer_id * 2654435761U));
+	//producers start at different points of the trace so they do not arrive in lockstep
+	state->trace_index = trace_gaps.empty() ? 0 : (producer_id * 7919) % trace_gaps.size();
+}
+
+/* Exponentially distributed gap for the given rate, in nanoseconds */
+static long long exponential_gap (arrival_state *state, double rate)
+{
+	double uniform = (rand_r(&state->seed) + 1.0) / ((double) RAND_MAX + 2.0);
+	return (long long) (-log(uniform) / rate * 1e9);
+}
+
+/* Instantaneous diurnal rate at time t */
+static double diurnal_rate (arrival_state *state, long long t)
+{
+	double phase = 2 * M_PI * (double) (t - state->start_ns) / (arrivals.diurnal_period_s * 1e9);
+	return arrivals.rate * (1.0 + arrivals.diurnal_amplitude / 100.0 * sin(phase));
+}
+
+long long arrival_next (arrival_state *state)
+{
+	long long arrival = state->next_ns;
+
+	switch (arrivals.process)
+	{
+		case ARRIVAL_CONSTANT:
+			state->next_ns += (long long) (1e9 / arrivals.rate);
+			break;
+
+		case ARRIVAL_POISSON:
+			state->next_ns += exponential_gap(state, arrivals.rate);
+			break;
+
+		case ARRIVAL_BURSTY:
+		{
+			//Poisson arrivals during the on period, scaled so the long-run mean is still rate
+			long long on_ns = arrivals.burst_on_ms * 1000000LL;
+			long long cycle_ns = on_ns + arrivals.burst_off_ms * 1000000LL;
+			double on_rate = arrivals.rate * cycle_ns / on_ns;
+			long long next = state->next_ns + exponential_gap(state, on_rate);
+			long long offset = (next - state->start_ns) % cycle_ns;
+			if (offset >= on_ns)
+				next += cycle_ns - offset;
+			state->next_ns = next;
+			break;
+		}
+
+		case ARRIVAL_DIURNAL:
+		{
+			//non-homogeneous Poisson process generated by thinning against the peak rate
+			double peak = arrivals.rate * (1.0 + arrivals.diurnal_amplitude / 100.0);
+			long long next = state->next_ns;
+			do
+				next += exponential_gap(state, peak);
+			while (rand_r(&state->seed) / ((double) RAND_MAX + 1.0) * peak > diurnal_rate(state, next));
+			state->next_ns = next;
+			break;
+		}
+
+		case ARRIVAL_TRACE:
+			state->next_ns += trace_gaps[state->trace_index];
+			state->trace_index = (state->trace_index + 1) % trace_gaps.size();
+			break;
+
+		case ARRIVAL_CLOSED:
+			break;
+	}
+
+	return arrival;
+}
+
+void arrival_sleep_until (long long deadline_ns)
+{
+	struct timespec deadline;
+	deadline.tv_sec = deadline_ns / 1000000000LL;
+	deadline.tv_nsec = deadline_ns % 1000000000LL;
+
+	//an arrival that is already late is issued immediately, the schedule is never shifted
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+		;
+}
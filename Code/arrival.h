@@ -0,0 +1,45 @@
+/******************************************************************
+ * Header file for the open-loop arrival generator. Each producer
+ * owns an arrival_state and asks it for the absolute (monotonic)
+ * time at which its next job is due, independently of how long
+ * the previous deposit took.
+ ******************************************************************/
+
+#ifndef ARRIVAL_H
+#define ARRIVAL_H
+
+#include "helper.h"
+
+/* Arrival processes supported by the generator */
+enum arrival_process { ARRIVAL_CLOSED, ARRIVAL_CONSTANT, ARRIVAL_POISSON, ARRIVAL_BURSTY, ARRIVAL_DIURNAL, ARRIVAL_TRACE };
+
+/* Settings shared by every producer */
+struct arrival_config
+{
+	arrival_process process;
+	double rate;			//mean jobs per second per producer
+	int burst_on_ms;		//bursty: length of the on period
+	int burst_off_ms;		//bursty: length of the off period
+	int diurnal_period_s;	//diurnal: length of one full cycle
+	int diurnal_amplitude;	//diurnal: swing around the mean rate, in percent
+	const char *trace_path;	//trace: text file of inter-arrival times in milliseconds
+};
+
+/* Per-producer generator state */
+struct arrival_state
+{
+	long long start_ns;
+	long long next_ns;
+	unsigned int seed;
+	size_t trace_index;
+};
+
+extern arrival_config arrivals;
+
+int arrival_process_from_name (const char *name);
+int arrival_setup ();
+void arrival_start (arrival_state *state, int producer_id);
+long long arrival_next (arrival_state *state);
+void arrival_sleep_until (long long deadline_ns);
+
+#endif
@@ -0,0 +1,121 @@
+/******************************************************************
+ * Micro-benchmark for the queue backings. Fills and drains the
+ * ring repeatedly, single threaded, so that only the cost of the
+ * backing memory is measured (no semaphores, no sleeps).
+ *
+ * It also times the semaphore operations of one deposit and one
+ * fetch for every synchronization backend (uncontended), and for
+ * SysV with and without SEM_UNDO.
+ *
+ * Usage: ./bench <buffer_size> <rounds> [ring_file]
+ ******************************************************************/
+
+#include "queue.h"
+#include "sync.h"
+
+/* Function used to time a number of fill/drain rounds over the current queue */
+double run_rounds(int size, int rounds)
+{
+	struct timespec start, end;
+	job temp_job;
+	long checksum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int r = 0; r < rounds; r++)
+	{
+		for (int i = 0; i < size; i++)
+		{
+			temp_job.job_id = i + 1;
+			temp_job.duration = r;
+			temp_job.seq = (unsigned long) r * size + i;
+			deposit_item(temp_job);
+		}
+		for (int i = 0; i < size; i++)
+			checksum += fetch_item().job_id;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	//keep the compiler from discarding the loops
+	if (checksum == -1)
+		printf("%ld\n", checksum);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	return seconds * 1e9 / ((double) size * rounds);
+}
+
+/* Function used to time the four combined operations of a deposit/fetch pair */
+double run_semaphores(int size, int rounds)
+{
+	const sem_op_entry take_space[] = { {1, -1}, {2, -1} };
+	const sem_op_entry give_item[] = { {2, 1}, {0, 1} };
+	const sem_op_entry take_item[] = { {0, -1}, {2, -1} };
+	const sem_op_entry give_space[] = { {2, 1}, {1, 1} };
+	long long start = now_ns();
+
+	for (long i = 0; i < (long) size * rounds; i++)
+	{
+		sync_op_many(take_space, 2, -1);
+		sync_op_many(give_item, 2, -1);
+		sync_op_many(take_item, 2, -1);
+		sync_op_many(give_space, 2, -1);
+	}
+	return (double) (now_ns() - start) / ((double) size * rounds);
+}
+
+int main(int argc, char **argv)
+{
+	int size, rounds;
+	const char *ring_path = "bench.ring";
+
+	if (argc < 3 || (size = check_arg(argv[1])) <= 0 || (rounds = check_arg(argv[2])) <= 0)
+	{
+		cerr << "Usage: " << argv[0] << " <buffer_size> <rounds> [ring_file]" << endl;
+		return INCORRECT_NUMBER_OF_ARGUMENTS;
+	}
+	if (argc > 3)
+		ring_path = argv[3];
+
+	if (initializeQueue(size, NULL, false) != 0)
+		return errno;
+	printf("heap (new job[%d]):  %8.2f ns per deposit+fetch\n", size, run_rounds(size, rounds));
+	destroyQueue();
+
+	if (initializeQueue(size, NULL, true) != 0)
+		return errno;
+	printf("heap (%s): %8.2f ns per deposit+fetch\n", queue_page_kind(), run_rounds(size, rounds));
+	destroyQueue();
+
+	unlink(ring_path);
+	if (initializeQueue(size, ring_path, false) != 0)
+	{
+		cerr << "Unable to map '" << ring_path << "': " << strerror(errno) << endl;
+		return errno;
+	}
+	printf("ring file (%s): %8.2f ns per deposit+fetch\n", ring_path, run_rounds(size, rounds));
+	destroyQueue();
+	unlink(ring_path);
+
+	const char *names[] = { "sysv", "posix", "condvar", "futex", "eventfd" };
+	for (int i = 0; i < 5; i++)
+	{
+		sync_select(names[i]);
+		if (sync_create(3) != 0)
+		{
+			print_sync_error(errno, true);
+			return errno;
+		}
+		sync_init(0, 0);
+		sync_init(1, size);
+		sync_init(2, 1);
+		sem_set_undo(true);
+		printf("%-8s semaphores:         %8.2f ns per deposit+fetch\n", names[i], run_semaphores(size, rounds));
+		if (i == 0)
+		{
+			sem_set_undo(false);
+			printf("sysv without SEM_UNDO:      %8.2f ns per deposit+fetch\n", run_semaphores(size, rounds));
+		}
+		sync_close();
+	}
+
+	return NO_ERROR;
+}
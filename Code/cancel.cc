@@ -0,0 +1,101 @@
+/******************************************************************
+ * The tombstone table for cancelled jobs:
+ * cancel_init - Allocates an open-addressed table for the given number of jobs
+ * cancel_job - Marks a sequence number cancelled, from any thread
+ * cancel_check - Tells a consumer whether a fetched job must be skipped
+ *
+ * Slots hold sequence numbers (0 marks a free slot) and are claimed
+ * with a compare-and-swap, probing linearly. Sequence numbers are
+ * never reused, so tombstones are never removed and a lookup can
+ * stop at the first free slot without taking any lock.
+ ******************************************************************/
+
+#include "cancel.h"
+
+static unsigned long *tombstones = NULL;
+static unsigned long table_mask = 0;
+
+static long cancelled = 0, skipped_cancelled = 0, skipped_expired = 0, table_full = 0;
+
+int cancel_init (long capacity)
+{
+	unsigned long size = 1024;
+
+	//keep the table at most half full so probe sequences stay short
+	while (size < (unsigned long) capacity * 2)
+		size <<= 1;
+	tombstones = new unsigned long[size]();
+	table_mask = size - 1;
+	return 0;
+}
+
+static unsigned long slot_of (unsigned long seq)
+{
+	return (seq * 0x9E3779B97F4A7C15UL) >> 20 & table_mask;
+}
+
+bool cancel_job (unsigned long seq)
+{
+	if (tombstones == NULL || seq == 0)
+		return false;
+
+	unsigned long slot = slot_of(seq);
+	for (unsigned long probes = 0; probes <= table_mask; probes++, slot = (slot + 1) & table_mask)
+	{
+		//claim a free slot, or find out what the thread that beat us to it wrote
+		unsigned long previous = __sync_val_compare_and_swap(&tombstones[slot], 0, seq);
+		if (previous == 0)
+		{
+			__sync_fetch_and_add(&cancelled, 1);
+			return true;
+		}
+		if (previous == seq)
+			return false;
+	}
+	__sync_fetch_and_add(&table_full, 1);
+	return false;
+}
+
+static bool is_cancelled (unsigned long seq)
+{
+	if (tombstones == NULL)
+		return false;
+
+	unsigned long slot = slot_of(seq);
+	for (unsigned long probes = 0; probes <= table_mask; probes++, slot = (slot + 1) & table_mask)
+	{
+		unsigned long current = __atomic_load_n(&tombstones[slot], __ATOMIC_ACQUIRE);
+		if (current == seq)
+			return true;
+		if (current == 0)
+			return false;
+	}
+	return false;
+}
+
+int cancel_check (const job *fetched, long long now)
+{
+	if (is_cancelled(fetched->seq))
+	{
+		__sync_fetch_and_add(&skipped_cancelled, 1);
+		return SKIP_CANCELLED;
+	}
+	if (fetched->deadline_ns > 0 && now > fetched->deadline_ns)
+	{
+		__sync_fetch_and_add(&skipped_expired, 1);
+		return SKIP_EXPIRED;
+	}
+	return SKIP_NONE;
+}
+
+void print_cancel_statistics ()
+{
+	printf("Cancellation: cancelled %ld skipped %ld (cancelled %ld expired %ld) table full %ld\n",
+		cancelled, skipped_cancelled + skipped_expired, skipped_cancelled, skipped_expired, table_full);
+}
+
+void cancel_destroy ()
+{
+	delete[] tombstones;
+	tombstones = NULL;
+}
@@ -0,0 +1,23 @@
+/******************************************************************
+ * Header file for job cancellation. Cancelled sequence numbers are
+ * recorded in a lock-free tombstone table; consumers look every job
+ * up (and compare its deadline with the clock) right after fetching
+ * it, and skip dead jobs instead of executing them.
+ ******************************************************************/
+
+#ifndef CANCEL_H
+#define CANCEL_H
+
+#include "queue.h"
+
+#define SKIP_NONE		0
+#define SKIP_CANCELLED	1
+#define SKIP_EXPIRED	2
+
+int cancel_init (long capacity);
+bool cancel_job (unsigned long seq);
+int cancel_check (const job *fetched, long long now);
+void print_cancel_statistics ();
+void cancel_destroy ();
+
+#endif
@@ -0,0 +1,191 @@
+#!/bin/sh
+######################################################################
+# Regression checks for main, run by "make check". Every check drives
+# main with crafted replay traces (and ingestion frames) and asserts
+# on the jobs it reports:
+# journal_restart - Jobs left in a killed run's journal are replayed
+#                   once and the new jobs get fresh sequence numbers
+# ring_restart    - Jobs left in a killed run's ring file are restored,
+#                   and their sequence numbers do not collide with the
+#                   jobs the new run cancels
+# ingest_framing  - Frames split across writes are reassembled, and
+#                   durations out of range are rejected
+# dag_ordering    - A held job only starts once its predecessor is done
+#
+# Consumers leave after 20 idle seconds, so every run takes at least
+# that long. Usage: ./check.sh [path to main]
+######################################################################
+
+MAIN=$(cd "$(dirname "${1:-./main}")" && pwd)/$(basename "${1:-./main}")
+WORK=$(mktemp -d /tmp/pcq-check.XXXXXX)
+FAILED=0
+
+# Writes a trace: every argument is "offset_ms:producer:duration"
+trace ()
+{
+	out=$1
+	shift
+	python3 - "$out" "$@" <<'EOF'
+import struct, sys
+with open(sys.argv[1], 'wb') as f:
+    f.write(b'PCQTRACE' + struct.pack('=i', 1))
+    for job in sys.argv[2:]:
+        offset, producer, duration = (int(x) for x in job.split(':'))
+        f.write(struct.pack('=qiii', offset * 1000000, producer, duration, 0))
+EOF
+}
+
+# Counts the lines of a run's output matching a pattern
+count ()
+{
+	grep -c -- "$2" "$1"
+}
+
+# Records a check's outcome: name, then the failure reason if any
+verdict ()
+{
+	if [ -z "$2" ]; then
+		echo "PASS $1"
+	else
+		echo "FAIL $1: $2"
+		FAILED=1
+	fi
+}
+
+journal_restart ()
+{
+	dir=$WORK/journal
+	mkdir -p "$dir"
+	trace "$dir/first.trace" 0:1:5 0:1:2 0:1:2 0:1:2
+	trace "$dir/second.trace" 0:1:1 0:1:1
+
+	# the consumer is still on the first job when the run is killed
+	"$MAIN" 4 1 1 1 journal="$dir/jobs.journal" replay="$dir/first.trace" > "$dir/first.out" 2>&1 &
+	sleep 2
+	kill -9 $! 2> /dev/null
+	wait $! 2> /dev/null
+
+	"$MAIN" 4 1 1 1 journal="$dir/jobs.journal" replay="$dir/second.trace" > "$dir/second.out" 2>&1
+	reason=
+	[ "$(count "$dir/second.out" 'replayed from the journal')" -eq 4 ] || reason="expected 4 jobs replayed from the journal"
+	[ -z "$reason" ] && [ "$(count "$dir/second.out" '^Consumer([0-9]*): Job .* completed')" -ne 6 ] && reason="expected 6 completed jobs"
+	[ -z "$reason" ] && reason=$(python3 - "$dir/jobs.journal" <<'EOF'
+import struct, sys
+data = open(sys.argv[1], 'rb').read()
+deposits, completes = [], set()
+for i in range(0, len(data) - len(data) % 16, 16):
+    kind, duration, seq = struct.unpack('=iiQ', data[i:i + 16])
+    (deposits.append(seq) if kind == 1 else completes.add(seq))
+if len(deposits) != len(set(deposits)):
+    print("a sequence number was deposited twice")
+elif set(deposits) != set(range(1, 7)):
+    print("expected sequence numbers 1-6, journal has %s" % sorted(deposits))
+elif not completes >= set(deposits):
+    print("jobs %s never completed" % sorted(set(deposits) - completes))
+EOF
+)
+	verdict journal_restart "$reason"
+}
+
+ring_restart ()
+{
+	dir=$WORK/ring
+	mkdir -p "$dir"
+	trace "$dir/first.trace" 0:1:5 0:1:2 0:1:2 0:1:2
+	trace "$dir/second.trace" 0:1:1 0:1:1 0:1:1
+
+	"$MAIN" 8 1 1 1 ring_file="$dir/jobs.ring" replay="$dir/first.trace" > "$dir/first.out" 2>&1 &
+	sleep 2
+	kill -9 $! 2> /dev/null
+	wait $! 2> /dev/null
+
+	# every new job is deposited and cancelled while the consumer is busy with the restored
+	# ones, which would be skipped as well if they shared sequence numbers with them
+	"$MAIN" 8 1 1 1 ring_file="$dir/jobs.ring" replay="$dir/second.trace" cancel=100 > "$dir/second.out" 2>&1
+	reason=
+	[ "$(count "$dir/second.out" '^Recovery: item 3 ')" -eq 1 ] || reason="expected 3 jobs restored from the ring"
+	[ -z "$reason" ] && [ "$(count "$dir/second.out" '^Consumer([0-9]*): Job .* completed')" -ne 3 ] && reason="expected the 3 restored jobs to complete"
+	[ -z "$reason" ] && [ "$(count "$dir/second.out" 'skipped (cancelled)')" -ne 3 ] && reason="expected the 3 new jobs to be skipped"
+	verdict ring_restart "$reason"
+}
+
+ingest_framing ()
+{
+	dir=$WORK/ingest
+	mkdir -p "$dir"
+	trace "$dir/run.trace" 0:1:1
+
+	"$MAIN" 8 1 1 1 ingest="$dir/ingest.sock" ingest_idle=3 replay="$dir/run.trace" > "$dir/run.out" 2>&1 &
+	# two frames sent in pieces that split the first header and a duration;
+	# 0 and 11 (above ingest_max_duration) are rejected
+	python3 - "$dir/ingest.sock" <<'EOF'
+import socket, struct, sys, time
+frames = struct.pack('=II', 4, 7) + struct.pack('=4i', 1, 0, 2, 11) + struct.pack('=II', 2, 7) + struct.pack('=2i', 1, 1)
+for attempt in range(50):
+    try:
+        sender = socket.socket(socket.AF_UNIX)
+        sender.connect(sys.argv[1])
+        break
+    except OSError:
+        time.sleep(0.1)
+for piece in (frames[:5], frames[5:18], frames[18:]):
+    sender.sendall(piece)
+    time.sleep(0.2)
+sender.close()
+EOF
+	wait $!
+	reason=
+	[ "$(count "$dir/run.out" '^Ingest: connections 1 frames 2 jobs 4 rejected 2 ')" -eq 1 ] || reason="expected 2 frames, 4 jobs and 2 rejected durations"
+	[ -z "$reason" ] && [ "$(count "$dir/run.out" '^Consumer([0-9]*): Job .* completed')" -ne 5 ] && reason="expected 5 completed jobs"
+	verdict ingest_framing "$reason"
+}
+
+dag_ordering ()
+{
+	dir=$WORK/dag
+	mkdir -p "$dir"
+	trace "$dir/run.trace" 0:1:3 0:1:1 0:1:1 0:1:1 0:1:1 0:1:1 0:1:1 0:1:1
+
+	# with a window of one job a held job can only depend on the job just before it
+	"$MAIN" 8 1 1 3 dag_deps=1 dag_window=1 replay="$dir/run.trace" > "$dir/run.out" 2>&1
+	reason=$(python3 - "$dir/run.out" <<'EOF'
+import re, sys
+lines = open(sys.argv[1]).read().splitlines()
+names, held = [None], set()
+for line in lines:
+    deposit = re.match(r'Producer\(1\): Job ID (\d+) duration', line)
+    waiting = re.match(r'Producer\(1\): Job seq (\d+) duration \d+ held', line)
+    if deposit:
+        names.append('Job ID ' + deposit.group(1))
+    elif waiting:
+        names.append('Job seq ' + waiting.group(1))
+        held.add(int(waiting.group(1)))
+def first(pattern):
+    return next((i for i, line in enumerate(lines) if re.match(pattern, line)), None)
+if len(names) != 9:
+    print("expected 8 jobs from the producer")
+elif not held:
+    print("no job was held")
+for seq in sorted(held):
+    done = first(r'Consumer\(\d+\): %s completed$' % names[seq - 1])
+    start = first(r'Consumer\(\d+\): Job seq %d executing' % seq)
+    if done is None or start is None or start < done:
+        print("job seq %d started before job seq %d completed" % (seq, seq - 1))
+        break
+EOF
+)
+	[ -z "$reason" ] && [ "$(count "$dir/run.out" '^Consumer([0-9]*): Job .* completed')" -ne 8 ] && reason="expected 8 completed jobs"
+	verdict dag_ordering "$reason"
+}
+
+journal_restart
+ring_restart
+ingest_framing
+dag_ordering
+
+if [ $FAILED -eq 0 ]; then
+	rm -rf "$WORK"
+else
+	echo "Outputs kept in $WORK"
+fi
+exit $FAILED
@@ -0,0 +1,137 @@
+/******************************************************************
+ * The dependency scheduler:
+ * dag_init - Allocates one node per job sequence number
+ * dag_add_job - Registers a job and its predecessors, returns true if runnable
+ * dag_complete - Marks a job done and releases the successors it unblocks
+ * dag_take_ready - Pops the calling thread's next released job
+ *
+ * Every node's in-degree is an atomic counter that starts at 1 (a
+ * sentinel held by dag_add_job while edges are added), so a job can
+ * never become runnable before all its edges are in place. Adding an
+ * edge and completing a node serialise on a small per-node lock.
+ ******************************************************************/
+
+#include "dag.h"
+#include <deque>
+#include <vector>
+
+struct dag_node
+{
+	int in_degree;
+	bool completed;
+	pthread_mutex_t lock;
+	vector<unsigned long> successors;
+	job held;
+};
+
+static dag_node *nodes = NULL;
+static unsigned long base_seq = 0;
+static long node_count = 0;
+
+/* Jobs released on this thread and not yet run, freed when the thread exits */
+static thread_local deque<job> local_ready;
+
+static long held_jobs = 0, released_jobs = 0, edges = 0;
+
+int dag_init (unsigned long first_seq, long capacity)
+{
+	base_seq = first_seq;
+	node_count = capacity;
+	nodes = new dag_node[capacity];
+	for (long i = 0; i < capacity; i++)
+	{
+		nodes[i].in_degree = 0;
+		nodes[i].completed = false;
+		pthread_mutex_init(&nodes[i].lock, NULL);
+	}
+	return 0;
+}
+
+bool dag_enabled ()
+{
+	return nodes != NULL;
+}
+
+/* Node of a sequence number, NULL for jobs outside the graph (journal, ingestion) */
+static dag_node *node_of (unsigned long seq)
+{
+	if (nodes == NULL || seq < base_seq || seq >= base_seq + node_count)
+		return NULL;
+	return &nodes[seq - base_seq];
+}
+
+bool dag_add_job (const job *new_job, const unsigned long *predecessors, int count)
+{
+	dag_node *node = node_of(new_job->seq);
+	if (node == NULL)
+		return true;
+
+	node->held = *new_job;
+	__atomic_store_n(&node->in_degree, 1, __ATOMIC_RELAXED);
+
+	for (int i = 0; i < count; i++)
+	{
+		dag_node *predecessor = node_of(predecessors[i]);
+		if (predecessor == NULL)
+			continue;
+		pthread_mutex_lock(&predecessor->lock);
+		if (!predecessor->completed)
+		{
+			predecessor->successors.push_back(new_job->seq);
+			__atomic_fetch_add(&node->in_degree, 1, __ATOMIC_RELAXED);
+			__sync_fetch_and_add(&edges, 1);
+		}
+		pthread_mutex_unlock(&predecessor->lock);
+	}
+
+	//drop the sentinel: if no predecessor is pending the caller runs the job now
+	if (__atomic_sub_fetch(&node->in_degree, 1, __ATOMIC_ACQ_REL) == 0)
+		return true;
+	__sync_fetch_and_add(&held_jobs, 1);
+	return false;
+}
+
+void dag_complete (unsigned long seq)
+{
+	vector<unsigned long> successors;
+	dag_node *node = node_of(seq);
+	if (node == NULL)
+		return;
+
+	pthread_mutex_lock(&node->lock);
+	node->completed = true;
+	successors.swap(node->successors);
+	pthread_mutex_unlock(&node->lock);
+
+	for (size_t i = 0; i < successors.size(); i++)
+	{
+		dag_node *successor = node_of(successors[i]);
+		if (__atomic_sub_fetch(&successor->in_degree, 1, __ATOMIC_ACQ_REL) == 0)
+		{
+			local_ready.push_back(successor->held);
+			__sync_fetch_and_add(&released_jobs, 1);
+		}
+	}
+}
+
+bool dag_take_ready (job *ready)
+{
+	if (local_ready.empty())
+		return false;
+	*ready = local_ready.front();
+	local_ready.pop_front();
+	return true;
+}
+
+void print_dag_statistics ()
+{
+	printf("DAG: edges %ld held jobs %ld released jobs %ld\n", edges, held_jobs, released_jobs);
+}
+
+void dag_destroy ()
+{
+	for (long i = 0; i < node_count; i++)
+		pthread_mutex_destroy(&nodes[i].lock);
+	delete [] nodes;
+	nodes = NULL;
+}
@@ -0,0 +1,22 @@
+/******************************************************************
+ * Header file for dependency scheduling. A job may depend on jobs
+ * produced before it; it is held back until all of them complete.
+ * Jobs made runnable by a completion land on the completing thread's
+ * local ready queue, so a consumer runs them next (its caches still
+ * hold the predecessor's state) without going through the buffer.
+ ******************************************************************/
+
+#ifndef DAG_H
+#define DAG_H
+
+#include "queue.h"
+
+int dag_init (unsigned long first_seq, long capacity);
+bool dag_enabled ();
+bool dag_add_job (const job *new_job, const unsigned long *predecessors, int count);
+void dag_complete (unsigned long seq);
+bool dag_take_ready (job *ready);
+void print_dag_statistics ();
+void dag_destroy ();
+
+#endif
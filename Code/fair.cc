@@ -0,0 +1,149 @@
+/******************************************************************
+ * Deficit round robin over per-producer sub-queues:
+ * fair_init - Carves the job array into one region per sub-queue
+ * fair_slots - Returns the number of slots of a producer's sub-queue
+ * fair_next_slot - Returns the slot the producer's next job will occupy
+ * fair_deposit - Appends a job to its producer's sub-queue
+ * fair_fetch - Picks the next job by deficit round robin
+ *
+ * Every call is made with mutex held, like deposit_item and
+ * fetch_item. A sub-queue earns quantum seconds of credit each time
+ * the round reaches it and may dequeue jobs while their duration fits
+ * in its credit; an emptied sub-queue loses the credit it had left.
+ ******************************************************************/
+
+#include "fair.h"
+
+/* A region of the job array used as the circular queue of one producer */
+struct sub_queue
+{
+	int base;
+	int size;
+	int head;
+	int tail;
+	int count;
+	long deficit;
+	long deposited, served, service; //service in seconds of job duration
+	long long wait_total_ns, wait_max_ns;
+};
+
+static sub_queue *sub_queues = NULL;
+static int queue_count = 0, quantum = 0;
+
+/* Round robin position, and whether the current sub-queue already got its quantum */
+static int current = 0;
+static bool granted = false;
+
+int fair_init (int queues, const int *slots, int quantum_seconds)
+{
+	int base = 0;
+
+	sub_queues = new sub_queue[queues]();
+	queue_count = queues;
+	quantum = quantum_seconds;
+	for (int q = 0; q < queues; q++)
+	{
+		sub_queues[q].base = base;
+		sub_queues[q].size = slots[q];
+		base += slots[q];
+	}
+	return 0;
+}
+
+bool fair_enabled ()
+{
+	return sub_queues != NULL;
+}
+
+int fair_slots (int producer_id)
+{
+	return sub_queues[producer_id].size;
+}
+
+int fair_next_slot (int producer_id)
+{
+	sub_queue *q = &sub_queues[producer_id];
+	return q->base + q->tail;
+}
+
+void fair_deposit (job new_job)
+{
+	sub_queue *q = &sub_queues[new_job.producer_id];
+
+	my_queue->data[q->base + q->tail] = new_job;
+	q->tail = (q->tail + 1) % q->size;
+	q->count++;
+	q->deposited++;
+}
+
+static void next_queue ()
+{
+	current = (current + 1) % queue_count;
+	granted = false;
+}
+
+job fair_fetch ()
+{
+	//the caller holds an item, so some sub-queue is non-empty and the loop ends
+	for (;;)
+	{
+		sub_queue *q = &sub_queues[current];
+		if (q->count == 0)
+		{
+			q->deficit = 0;
+			next_queue();
+			continue;
+		}
+		if (!granted)
+		{
+			q->deficit += quantum;
+			granted = true;
+		}
+
+		job *head = &my_queue->data[q->base + q->head];
+		if (head->duration > q->deficit)
+		{
+			next_queue();
+			continue;
+		}
+
+		job fetched = *head;
+		q->head = (q->head + 1) % q->size;
+		q->count--;
+		q->deficit -= fetched.duration;
+		q->served++;
+		q->service += fetched.duration;
+
+		long long waited = now_ns() - fetched.produced_ns;
+		q->wait_total_ns += waited;
+		if (waited > q->wait_max_ns)
+			q->wait_max_ns = waited;
+
+		if (q->count == 0)
+		{
+			q->deficit = 0;
+			next_queue();
+		}
+		return fetched;
+	}
+}
+
+void print_fair_statistics ()
+{
+	printf("Fair queueing: quantum %d s\n", quantum);
+	for (int q = 0; q < queue_count; q++)
+	{
+		sub_queue *sq = &sub_queues[q];
+		if (sq->size == 0)
+			continue;
+		printf("  %s %d: slots %d deposited %ld served %ld service %ld s wait avg %.2f ms max %.2f ms\n",
+			q ? "Producer" : "Shared", q, sq->size, sq->deposited, sq->served, sq->service,
+			sq->served ? sq->wait_total_ns / 1000000.0 / sq->served : 0.0, sq->wait_max_ns / 1000000.0);
+	}
+}
+
+void fair_destroy ()
+{
+	delete[] sub_queues;
+	sub_queues = NULL;
+}
@@ -0,0 +1,24 @@
+/******************************************************************
+ * Header file for fair queueing. The buffer is split into one
+ * sub-queue per producer (sub-queue 0 holds jobs from the journal
+ * and the ingestion front-end), each with its own space semaphore,
+ * and consumers pick the next job by deficit round robin where the
+ * cost of a job is its duration. A producer can then only fill its
+ * own share of the buffer and gets its share of consumer time.
+ ******************************************************************/
+
+#ifndef FAIR_H
+#define FAIR_H
+
+#include "queue.h"
+
+int fair_init (int queues, const int *slots, int quantum);
+bool fair_enabled ();
+int fair_slots (int producer_id);
+int fair_next_slot (int producer_id);
+void fair_deposit (job new_job);
+job fair_fetch ();
+void print_fair_statistics ();
+void fair_destroy ();
+
+#endif
@@ -2,14 +2,33 @@
  * The helper file that contains the following helper functions:
  * check_arg - Checks if command line input is a number and returns it
  * sem_create - Create number of sempahores required in a semaphore array
+ * sem_create_private - Create a semaphore array no other instance can collide with
+ * sem_instance_key - Derive a per-instance key from a path with ftok
+ * sem_reclaim_stale - Remove a semaphore array left behind by a dead instance
+ * sem_reclaim_stale_private - Remove the private arrays left behind by dead instances
  * sem_init - Initialise particular semaphore in semaphore array
- * sem_wait - Waits on a semaphore (akin to down ()) in the semaphore array
- * sem_signal - Signals a semaphore (akin to up ()) in the semaphore array
  * sem_close - Destroy the semaphore array
+ * sem_set_undo - Selects whether operations are recorded for SEM_UNDO
+ * sem_try_wait - Down () on a semaphore without blocking
+ * sem_op_many - Applies several semaphore operations atomically in one semop
+ * sem_get_value - Reads the current value of a semaphore
+ * now_ns - Monotonic clock reading in nanoseconds
+ * histogram_* - Lock-free latency histogram and its percentiles
+ * option_value - Returns the value of a "name=value" argument
+ * spill_* - Disk-backed FIFO segment used to hold overflow records
  ******************************************************************/
 
 # include "helper.h"
 
+/* SEM_UNDO makes the kernel keep a per-process undo record updated on every operation.
+ * It can be turned off when the caller reconciles the semaphores itself at start-up. */
+static short sem_undo_flag = SEM_UNDO;
+
+void sem_set_undo (bool enabled)
+{
+  sem_undo_flag = enabled ? SEM_UNDO : 0;
+}
+
 int check_arg (char *buffer)
 {
   int i, num = 0, temp = 0;
@@ -33,6 +52,93 @@ int sem_create (key_t key, int num)
   return id;
 }
 
+/* A private set gets one semaphore more than asked for, holding SEM_PRIVATE_TAG, so
+ * that a stale one can be told apart from the private sets of other programs. */
+int sem_create_private (int num)
+{
+  int id = semget (IPC_PRIVATE, num + 1, SEM_PRIVATE_MODE | IPC_CREAT);
+  if (id < 0)
+    return -1;
+  if (sem_init (id, num, SEM_PRIVATE_TAG) < 0)
+  {
+    int error = errno;
+    sem_close (id);
+    errno = error;
+    return -1;
+  }
+  return id;
+}
+
+key_t sem_instance_key (const char *path, int instance)
+{
+  //ftok only uses the low 8 bits of the project id, and 0 is reserved
+  return ftok (path, (instance % 255) + 1);
+}
+
+/* A set is stale when no process that operated on it is still alive, or when
+ * nobody ever operated on it and it is older than SEM_STALE_SECONDS. Returns 1 if
+ * the set was removed, 0 if it is still in use and -1 on error. */
+static int reclaim_if_stale (int id)
+{
+  struct semid_ds status;
+  union semun semctl_arg;
+  bool operated = false;
+
+  semctl_arg.buf = &status;
+  if (semctl (id, 0, IPC_STAT, semctl_arg) < 0)
+    return -1;
+
+  for (unsigned long num = 0; num < status.sem_nsems; num++)
+  {
+    int pid = semctl (id, num, GETPID);
+    if (pid <= 0)
+      continue;
+    operated = true;
+    if (kill (pid, 0) == 0 || errno == EPERM)
+      return 0;
+  }
+
+  if (!operated && time (NULL) - status.sem_ctime < SEM_STALE_SECONDS)
+    return 0;
+
+  return (sem_close (id) == 0) ? 1 : -1;
+}
+
+int sem_reclaim_stale (key_t key)
+{
+  int id = semget (key, 0, 0);
+  if (id < 0)
+    return -1;
+  return reclaim_if_stale (id);
+}
+
+/* Private sets have no key to be found by, so every set in the system is listed
+ * with SEM_STAT and the stale ones owned by this user, created with
+ * SEM_PRIVATE_MODE and ending in a semaphore holding SEM_PRIVATE_TAG are removed.
+ * Returns how many were removed. */
+int sem_reclaim_stale_private ()
+{
+  struct seminfo info;
+  struct semid_ds status;
+  union semun semctl_arg;
+  int removed = 0;
+
+  semctl_arg.__buf = &info;
+  int highest = semctl (0, 0, SEM_INFO, semctl_arg);
+  for (int index = 0; index <= highest; index++)
+  {
+    semctl_arg.buf = &status;
+    int id = semctl (index, 0, SEM_STAT, semctl_arg);
+    if (id < 0 || status.sem_perm.__key != IPC_PRIVATE || status.sem_perm.uid != geteuid ()
+        || (status.sem_perm.mode & 0777) != SEM_PRIVATE_MODE || status.sem_nsems < 2
+        || semctl (id, status.sem_nsems - 1, GETVAL) != SEM_PRIVATE_TAG)
+      continue;
+    if (reclaim_if_stale (id) == 1)
+      removed++;
+  }
+  return removed;
+}
+
 int sem_init (int id, int num, int value)
 {
   union semun semctl_arg;
@@ -42,42 +148,179 @@ int sem_init (int id, int num, int value)
   return 0;
 }
 
-void sem_wait (int id, short unsigned int num)
+int sem_close (int id)
 {
-  struct sembuf op[] = {
-    {num, -1, SEM_UNDO}
-  };
-  semop (id, op, 1);
+  if (semctl (id, 0, IPC_RMID, 0) < 0)
+    return -1;
+  return 0;
 }
 
-void sem_signal (int id, short unsigned int num)
+int sem_try_wait (int id, short unsigned int num)
 {
   struct sembuf op[] = {
-    {num, 1, SEM_UNDO}
+    {num, -1, (short) (sem_undo_flag | IPC_NOWAIT)}
   };
-  semop (id, op, 1);
+  return semop (id, op, 1);
 }
 
-int sem_close (int id)
+long long now_ns ()
 {
-  if (semctl (id, 0, IPC_RMID, 0) < 0)
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int histogram_index (long long ns)
+{
+  if (ns < 16)
+    return (ns < 0) ? 0 : (int) ns;
+  int msb = 63 - __builtin_clzll (ns);
+  return (msb - 3) * 16 + (int) ((ns >> (msb - 4)) & 15);
+}
+
+/* Lowest value falling in a bucket */
+static long long histogram_value (int index)
+{
+  if (index < 16)
+    return index;
+  int msb = index / 16 + 3;
+  return (16LL + index % 16) << (msb - 4);
+}
+
+void histogram_record (latency_histogram *histogram, long long ns)
+{
+  long long seen = histogram->max_ns;
+  __sync_fetch_and_add (&histogram->counts[histogram_index (ns)], 1);
+  __sync_fetch_and_add (&histogram->total, 1);
+  __sync_fetch_and_add (&histogram->sum_ns, ns);
+  while (ns > seen && !__sync_bool_compare_and_swap (&histogram->max_ns, seen, ns))
+    seen = histogram->max_ns;
+}
+
+long long histogram_percentile (latency_histogram *histogram, double percentile)
+{
+  long rank = (long) ceil (histogram->total * percentile / 100.0), seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+  {
+    seen += histogram->counts[i];
+    if (seen >= rank && seen > 0)
+      return histogram_value (i);
+  }
+  return histogram->max_ns;
+}
+
+void print_histogram (const char *name, latency_histogram *histogram)
+{
+  if (histogram->total == 0)
+  {
+    printf("%s: no samples\n", name);
+    return;
+  }
+  printf("%s: n %ld mean %.3f p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f max %.3f (ms)\n", name, histogram->total,
+    histogram->sum_ns / 1e6 / histogram->total, histogram_percentile (histogram, 50) / 1e6,
+    histogram_percentile (histogram, 90) / 1e6, histogram_percentile (histogram, 99) / 1e6,
+    histogram_percentile (histogram, 99.9) / 1e6, histogram->max_ns / 1e6);
+}
+
+/* time_delay is in seconds: negative blocks forever, 0 fails at once with EAGAIN */
+int sem_op_many (int id, const sem_op_entry *ops, int count, int time_delay)
+{
+  struct sembuf op[count];
+  short flags = sem_undo_flag | (time_delay == 0 ? IPC_NOWAIT : 0);
+
+  for (int i = 0; i < count; i++)
+  {
+    op[i].sem_num = ops[i].num;
+    op[i].sem_op = ops[i].delta;
+    op[i].sem_flg = flags;
+  }
+
+  if (time_delay <= 0)
+    return semop (id, op, count);
+
+  struct timespec timeout;
+  timeout.tv_nsec = 0;
+  timeout.tv_sec = time_delay;
+  return semtimedop (id, op, count, &timeout);
+}
+
+int sem_get_value (int id, short unsigned int num)
+{
+  return semctl (id, num, GETVAL);
+}
+
+const char *option_value (const char *arg, const char *name)
+{
+  size_t length = strlen (name);
+  if (strncmp (arg, name, length) != 0 || arg[length] != '=')
+    return NULL;
+  return arg + length + 1;
+}
+
+/* State of the spill segment. Records are appended at write_offset and consumed
+ * from read_offset; the file is truncated whenever the reader catches up. */
+static int spill_fd = -1;
+static size_t spill_record_size = 0;
+static off_t spill_read_offset = 0, spill_write_offset = 0;
+
+int spill_open (const char *path, size_t record_size)
+{
+  if (path == NULL)
+  {
+    FILE *file = tmpfile ();
+    if (file == NULL)
+      return -1;
+    spill_fd = dup (fileno (file));
+    fclose (file);
+  }
+  else
+    spill_fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+  if (spill_fd < 0)
     return -1;
+  spill_record_size = record_size;
+  spill_read_offset = spill_write_offset = 0;
   return 0;
 }
 
-int sem_timed_wait (int id, short unsigned int num, int time_delay)
+int spill_push (const void *record)
 {
-  struct sembuf op[] = {
-    {num, -1, SEM_UNDO}
-  };
-	
-	struct timespec timeout;
-	timeout.tv_nsec = 0;
-	timeout.tv_sec = time_delay;
+  if (pwrite (spill_fd, record, spill_record_size, spill_write_offset) != (ssize_t) spill_record_size)
+    return -1;
+  spill_write_offset += spill_record_size;
+  return 0;
+}
 
- 	int error = semtimedop (id, op, 1, &timeout);
-	
-	return error;
+int spill_pop (void *record)
+{
+  if (spill_read_offset == spill_write_offset)
+    return -1;
+  if (pread (spill_fd, record, spill_record_size, spill_read_offset) != (ssize_t) spill_record_size)
+    return -1;
+  spill_read_offset += spill_record_size;
+
+  //reclaim the disk space once every spilled record has been refilled
+  if (spill_read_offset == spill_write_offset)
+  {
+    spill_read_offset = spill_write_offset = 0;
+    if (ftruncate (spill_fd, 0) < 0)
+      return 0;
+  }
+  return 0;
+}
+
+long spill_count ()
+{
+  if (spill_record_size == 0)
+    return 0;
+  return (spill_write_offset - spill_read_offset) / spill_record_size;
+}
+
+void spill_close ()
+{
+  if (spill_fd >= 0)
+    close (spill_fd);
+  spill_fd = -1;
 }
 
 /* The following error messages were obtained from the linux manual page for semget(2)*/
@@ -87,12 +330,12 @@ void print_semget_error(int error)
 	{
 		case EACCES:
 			cerr << "A semaphore set exists for key, but the calling process does not have permission to access the set, and does not have the CAP_IPC_OWNER capability in the user namespace that governs its IPC namespace." << endl;
-			cerr << "Please use a different key in the 'helper.h' file " << endl;
+			cerr << "Please use a different sem_key_path or instance, or run without sem_key_path to get a private set." << endl;
 			break;
 		
 		case EEXIST:
 			cerr << "IPC_CREAT and IPC_EXCL were specified in semflg, but a semaphore set already exists for key. " << endl;
-			cerr << "Please verify status of semaphores using command line tools such as 'ipcs' and use 'ipcrm' for debugging. If the semaphore key is already in use by another user please change it in the 'helper.h' file." << endl;
+			cerr << "Please verify status of semaphores using command line tools such as 'ipcs' and use 'ipcrm' for debugging. If the set belongs to another running instance please use a different instance number." << endl;
 			break;
 
 		case ENOMEM:
@@ -1,9 +1,12 @@
 /******************************************************************
  * Header file for the helper functions. This file includes the
  * required header files, as well as the function signatures and
- * the semaphore values (which are to be changed as needed).
+ * the semaphore constants.
  ******************************************************************/
 
+#ifndef HELPER_H
+#define HELPER_H
+
 # include <stdio.h>
 # include <stdlib.h>
 # include <unistd.h>
@@ -12,34 +15,81 @@
 # include <sys/shm.h>
 # include <sys/sem.h>
 # include <sys/time.h>
+# include <sys/stat.h>
 # include <math.h>
 # include <errno.h>
 # include <string.h>
 # include <pthread.h>
+# include <signal.h>
 # include <ctype.h>
+# include <fcntl.h>
 # include <iostream>
 using namespace std;
 
-#define SEM_KEY 0x50 // Change this number as needed
+#define SEM_STALE_SECONDS 60 // Age after which an unused semaphore set counts as abandoned
+#define SEM_PRIVATE_MODE 0700 // Execute means nothing on a semaphore set, it marks the private sets created here
+#define SEM_PRIVATE_TAG 0x5043 // Value of the extra last semaphore that tags a private set as created here
 #define NON_POSITIVE_INTEGER		1
 #define INCORRECT_NUMBER_OF_ARGUMENTS 2
+#define INVALID_OPTION				3
 #define NO_ERROR					0
 
 union semun {
     int val;               /* used for SETVAL only */
     struct semid_ds *buf;  /* used for IPC_STAT and IPC_SET */
     ushort *array;         /* used for GETALL and SETALL */
+    struct seminfo *__buf; /* used for IPC_INFO and SEM_INFO */
 };
 
 int check_arg (char *);
 int sem_create (key_t, int);
+int sem_create_private (int num);
+key_t sem_instance_key (const char *path, int instance);
+int sem_reclaim_stale (key_t key);
+int sem_reclaim_stale_private ();
 int sem_init (int, int, int);
-void sem_wait (int, short unsigned int);
-void sem_signal (int, short unsigned int);
 int sem_close (int);
+void sem_set_undo (bool enabled);
+
+int sem_try_wait (int id, short unsigned int num);
 
-int sem_timed_wait (int id, short unsigned int num, int time_delay);
+//One semaphore operation of a combined semop; delta is added to semaphore num
+struct sem_op_entry
+{
+	short unsigned int num;
+	short delta;
+};
+int sem_op_many (int id, const sem_op_entry *ops, int count, int time_delay);
+int sem_get_value (int id, short unsigned int num);
+
+//Monotonic clock in nanoseconds, used for timing jobs
+long long now_ns ();
+
+//Log-linear histogram of durations in nanoseconds (16 sub-buckets per power of two)
+#define HISTOGRAM_BUCKETS 1024
+struct latency_histogram
+{
+	long counts[HISTOGRAM_BUCKETS];
+	long total;
+	long long sum_ns;
+	long long max_ns;
+};
+void histogram_record (latency_histogram *histogram, long long ns);
+long long histogram_percentile (latency_histogram *histogram, double percentile);
+void print_histogram (const char *name, latency_histogram *histogram);
+
+//Functions used for parsing optional "name=value" command line arguments
+const char *option_value (const char *arg, const char *name);
+
+//Functions used to manage the disk-backed spill segment (callers serialise access)
+int spill_open (const char *path, size_t record_size);
+int spill_push (const void *record);
+int spill_pop (void *record);
+long spill_count ();
+void spill_close ();
 
 //Functions used to print associated error to cerr stream
 void print_semget_error(int error);
 void print_semctl_error(int error);
+
+#endif
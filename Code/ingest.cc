@@ -0,0 +1,245 @@
+/******************************************************************
+ * The ingestion front-end:
+ * ingest_start - Binds the listener ("path" or "tcp:port") and starts its thread
+ * ingest_wait - Waits until the listener has been idle for idle_seconds
+ * print_ingest_statistics - Reports ingest throughput
+ *
+ * One thread multiplexes the listening socket and every connection with
+ * epoll. Each connection owns a byte ring; readv fills both free segments
+ * of the ring in one call and complete frames are parsed out of it.
+ ******************************************************************/
+
+#include "ingest.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define INGEST_RING_SIZE	65536
+#define INGEST_MAX_EVENTS	64
+
+/* Per-connection receive ring */
+struct ingest_connection
+{
+	int fd;
+	size_t head;	//offset of the first unparsed byte
+	size_t filled;	//number of unparsed bytes
+	char ring[INGEST_RING_SIZE];
+};
+
+static int listen_fd = -1, epoll_fd = -1;
+static int idle_limit, max_duration;
+static ingest_deposit_fn deposit_batch_fn;
+static pthread_t listener;
+static const char *unix_path = NULL;
+
+/* Throughput counters, only touched by the listener thread */
+static long connections = 0, frames = 0, jobs = 0, bytes = 0, rejected = 0;
+static long long first_byte_ns = 0, last_byte_ns = 0;
+
+/* Copies len bytes starting at offset out of the ring, following the wrap-around */
+static void ring_copy (ingest_connection *connection, size_t offset, void *target, size_t len)
+{
+	size_t start = (connection->head + offset) % INGEST_RING_SIZE;
+	size_t first = INGEST_RING_SIZE - start;
+
+	if (first >= len)
+		memcpy(target, connection->ring + start, len);
+	else
+	{
+		memcpy(target, connection->ring + start, first);
+		memcpy((char *) target + first, connection->ring, len - first);
+	}
+}
+
+/* Reads into both free segments of the ring with one readv. Returns bytes read, 0 on EOF. */
+static ssize_t ring_fill (ingest_connection *connection)
+{
+	struct iovec segments[2];
+	size_t tail = (connection->head + connection->filled) % INGEST_RING_SIZE;
+	size_t space = INGEST_RING_SIZE - connection->filled;
+	int count = 1;
+
+	segments[0].iov_base = connection->ring + tail;
+	segments[0].iov_len = min(space, (size_t) INGEST_RING_SIZE - tail);
+	if (segments[0].iov_len < space)
+	{
+		segments[1].iov_base = connection->ring;
+		segments[1].iov_len = space - segments[0].iov_len;
+		count = 2;
+	}
+
+	ssize_t received = readv(connection->fd, segments, count);
+	if (received > 0)
+		connection->filled += received;
+	return received;
+}
+
+/* Parses every complete frame in the ring. Returns -1 on a malformed frame. */
+static int parse_frames (ingest_connection *connection)
+{
+	ingest_header header;
+	int32_t durations[INGEST_MAX_BATCH];
+
+	while (connection->filled >= sizeof(header))
+	{
+		ring_copy(connection, 0, &header, sizeof(header));
+		if (header.count == 0 || header.count > INGEST_MAX_BATCH)
+			return -1;
+
+		size_t frame = sizeof(header) + header.count * sizeof(ingest_job);
+		if (connection->filled < frame)
+			break;
+
+		ring_copy(connection, sizeof(header), durations, header.count * sizeof(ingest_job));
+		connection->head = (connection->head + frame) % INGEST_RING_SIZE;
+		connection->filled -= frame;
+
+		//durations are held to the producers' range, 1 to max_duration seconds
+		int valid = 0;
+		for (uint32_t i = 0; i < header.count; i++)
+			if (durations[i] > 0 && durations[i] <= max_duration)
+				durations[valid++] = durations[i];
+			else
+				rejected++;
+
+		if (valid > 0)
+			deposit_batch_fn(durations, valid);
+		frames++;
+		jobs += valid;
+	}
+	return 0;
+}
+
+static void close_connection (ingest_connection *connection)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+	close(connection->fd);
+	delete connection;
+}
+
+static void *ingest_loop (void *)
+{
+	struct epoll_event events[INGEST_MAX_EVENTS];
+	long long idle_since = now_ns();
+	int open_connections = 0;
+
+	while (open_connections > 0 || now_ns() - idle_since < idle_limit * 1000000000LL)
+	{
+		int ready = epoll_wait(epoll_fd, events, INGEST_MAX_EVENTS, 200);
+		for (int i = 0; i < ready; i++)
+		{
+			if (events[i].data.ptr == NULL)
+			{
+				int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+				if (fd < 0)
+					continue;
+				ingest_connection *connection = new ingest_connection;
+				connection->fd = fd;
+				connection->head = connection->filled = 0;
+				struct epoll_event event;
+				event.events = EPOLLIN;
+				event.data.ptr = connection;
+				epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+				connections++;
+				open_connections++;
+				continue;
+			}
+
+			ingest_connection *connection = (ingest_connection *) events[i].data.ptr;
+			ssize_t received = ring_fill(connection);
+			if (received > 0)
+			{
+				if (first_byte_ns == 0)
+					first_byte_ns = now_ns();
+				last_byte_ns = now_ns();
+				bytes += received;
+			}
+			else if (received < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+
+			if (parse_frames(connection) != 0)
+			{
+				cerr << "Ingest: malformed frame, closing the connection" << endl;
+				received = 0;
+			}
+			if (received <= 0)
+			{
+				close_connection(connection);
+				open_connections--;
+				idle_since = now_ns();
+			}
+		}
+	}
+
+	close(epoll_fd);
+	close(listen_fd);
+	if (unix_path != NULL)
+		unlink(unix_path);
+	return NULL;
+}
+
+int ingest_start (const char *address, int idle_seconds, int max_duration_seconds, ingest_deposit_fn deposit)
+{
+	struct epoll_event event;
+
+	if (strncmp(address, "tcp:", 4) == 0)
+	{
+		struct sockaddr_in local;
+		int reuse = 1;
+		memset(&local, 0, sizeof(local));
+		local.sin_family = AF_INET;
+		local.sin_port = htons(atoi(address + 4));
+		local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if ((listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+			return -1;
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if (bind(listen_fd, (struct sockaddr *) &local, sizeof(local)) < 0)
+			return -1;
+	}
+	else
+	{
+		struct sockaddr_un local;
+		memset(&local, 0, sizeof(local));
+		local.sun_family = AF_UNIX;
+		if (strlen(address) >= sizeof(local.sun_path))
+		{
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		strcpy(local.sun_path, address);
+		unlink(address);
+		if ((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+			return -1;
+		if (bind(listen_fd, (struct sockaddr *) &local, sizeof(local)) < 0)
+			return -1;
+		unix_path = address;
+	}
+
+	if (listen(listen_fd, SOMAXCONN) < 0 || (epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return -1;
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+	idle_limit = idle_seconds;
+	max_duration = max_duration_seconds;
+	deposit_batch_fn = deposit;
+	return pthread_create(&listener, NULL, ingest_loop, NULL);
+}
+
+void ingest_wait ()
+{
+	pthread_join(listener, NULL);
+}
+
+void print_ingest_statistics ()
+{
+	double seconds = (last_byte_ns - first_byte_ns) / 1e9;
+	printf("Ingest: connections %ld frames %ld jobs %ld rejected %ld bytes %ld", connections, frames, jobs, rejected, bytes);
+	if (seconds > 0)
+		printf(" over %.3f s: %.0f jobs/s %.2f MB/s", seconds, jobs / seconds, bytes / seconds / 1e6);
+	printf("\n");
+}
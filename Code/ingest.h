@@ -0,0 +1,37 @@
+/******************************************************************
+ * Header file for the ingestion front-end. External processes
+ * connect to a Unix domain socket (or loopback TCP port) and send
+ * framed batches of jobs, which are handed to a batch deposit
+ * callback supplied by the caller.
+ *
+ * Frame: ingest_header followed by count ingest_job records, all
+ * in host byte order.
+ ******************************************************************/
+
+#ifndef INGEST_H
+#define INGEST_H
+
+#include "helper.h"
+#include <stdint.h>
+
+#define INGEST_MAX_BATCH	4096
+
+struct ingest_header
+{
+	uint32_t count;
+	uint32_t source_id;	//identifies the sender to the sender only, not used by the queue
+};
+
+struct ingest_job
+{
+	int32_t duration;
+};
+
+//Called with up to INGEST_MAX_BATCH durations from one frame
+typedef void (*ingest_deposit_fn) (const int32_t *durations, int count);
+
+int ingest_start (const char *address, int idle_seconds, int max_duration, ingest_deposit_fn deposit);
+void ingest_wait ();
+void print_ingest_statistics ();
+
+#endif
@@ -0,0 +1,249 @@
+/******************************************************************
+ * The write-ahead journal for queued jobs:
+ * journal_open - Replays an existing journal, compacts it and starts the flusher
+ * journal_recovered - Returns the deposits which never completed
+ * journal_deposit - Appends a deposit record to the current batch
+ * journal_complete - Appends a completion record to the current batch
+ * journal_close - Commits the last batch and stops the flusher
+ ******************************************************************/
+
+#include "journal.h"
+#include <map>
+#include <set>
+#include <vector>
+#include <libgen.h>
+
+/* The batch being filled by producers and consumers. The flusher swaps it out
+ * under journal_lock and writes it without holding the lock. */
+static vector<journal_record> journal_batch;
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journal_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t journal_flusher;
+static bool journal_stop = false;
+static int journal_fd = -1;
+static int sync_jobs, sync_ms;
+
+/* Unfinished deposits found when the journal was opened */
+static vector<journal_record> journal_pending;
+static unsigned long journal_max_seq = 0;
+
+/* Counters used to measure the cost of durability */
+static long records_written = 0, commits = 0, bytes_written = 0;
+static double fsync_total_ms = 0, fsync_max_ms = 0;
+
+static double elapsed_ms (struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* Function used to write a batch and make it durable with a single fsync */
+static void journal_commit (vector<journal_record> &batch)
+{
+	struct timespec start, end;
+	size_t length = batch.size() * sizeof(journal_record);
+	const char *buffer = (const char *) batch.data();
+
+	while (length > 0)
+	{
+		ssize_t written = write (journal_fd, buffer, length);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			cerr << "Journal write failed: " << strerror(errno) << endl;
+			return;
+		}
+		buffer += written;
+		length -= written;
+		bytes_written += written;
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	fdatasync (journal_fd);
+	clock_gettime (CLOCK_MONOTONIC, &end);
+
+	double duration = elapsed_ms (&start, &end);
+	fsync_total_ms += duration;
+	if (duration > fsync_max_ms)
+		fsync_max_ms = duration;
+	records_written += batch.size();
+	commits++;
+}
+
+/* Flusher thread: commits the batch once it holds sync_jobs records or sync_ms have passed */
+static void *journal_flush_loop (void *)
+{
+	vector<journal_record> batch;
+
+	pthread_mutex_lock (&journal_lock);
+	while (!journal_stop || !journal_batch.empty())
+	{
+		if (!journal_stop && (sync_jobs == 0 || (int) journal_batch.size() < sync_jobs))
+		{
+			if (sync_ms > 0)
+			{
+				struct timespec deadline;
+				clock_gettime (CLOCK_REALTIME, &deadline);
+				deadline.tv_sec += sync_ms / 1000;
+				deadline.tv_nsec += (sync_ms % 1000) * 1000000L;
+				if (deadline.tv_nsec >= 1000000000L)
+				{
+					deadline.tv_sec++;
+					deadline.tv_nsec -= 1000000000L;
+				}
+				if (pthread_cond_timedwait (&journal_cond, &journal_lock, &deadline) != ETIMEDOUT)
+					continue;
+			}
+			else
+			{
+				pthread_cond_wait (&journal_cond, &journal_lock);
+				continue;
+			}
+		}
+
+		if (journal_batch.empty())
+			continue;
+
+		batch.swap (journal_batch);
+		pthread_mutex_unlock (&journal_lock);
+		journal_commit (batch);
+		batch.clear ();
+		pthread_mutex_lock (&journal_lock);
+	}
+	pthread_mutex_unlock (&journal_lock);
+
+	return NULL;
+}
+
+/* Function used to read an existing journal and keep the deposits without a completion */
+static int journal_replay (const char *path)
+{
+	map<unsigned long, journal_record> deposits;
+	set<unsigned long> completed;
+	journal_record record;
+
+	int fd = open (path, O_RDONLY);
+	if (fd < 0)
+		return (errno == ENOENT) ? 0 : -1;
+
+	//a torn record at the end of the file is ignored
+	while (read (fd, &record, sizeof(record)) == sizeof(record))
+	{
+		if (record.seq > journal_max_seq)
+			journal_max_seq = record.seq;
+		if (record.type == JOURNAL_DEPOSIT)
+			deposits[record.seq] = record;
+		else if (record.type == JOURNAL_COMPLETE)
+			completed.insert (record.seq);
+	}
+	close (fd);
+
+	for (map<unsigned long, journal_record>::iterator it = deposits.begin(); it != deposits.end(); ++it)
+		if (completed.find (it->first) == completed.end())
+			journal_pending.push_back (it->second);
+
+	return 0;
+}
+
+/* Function used to make a rename in the directory holding path durable */
+static int sync_directory (const char *path)
+{
+	string copy = path;
+	int fd = open (dirname (&copy[0]), O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -1;
+	int result = fsync (fd);
+	close (fd);
+	return result;
+}
+
+int journal_open (const char *path, int sync_every_jobs, int sync_every_ms)
+{
+	string temporary = string(path) + ".tmp";
+
+	if (journal_replay (path) != 0)
+		return -1;
+
+	//compact the journal: only the unfinished deposits are carried over
+	int fd = open (temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return -1;
+	journal_fd = fd;
+	//with neither a batch size nor an interval every record is committed on its own
+	sync_jobs = (sync_every_jobs == 0 && sync_every_ms == 0) ? 1 : sync_every_jobs;
+	sync_ms = sync_every_ms;
+	if (!journal_pending.empty())
+		journal_commit (journal_pending);
+	if (rename (temporary.c_str(), path) != 0 || sync_directory (path) != 0)
+	{
+		close (fd);
+		journal_fd = -1;
+		return -1;
+	}
+	records_written = commits = bytes_written = 0;
+	fsync_total_ms = fsync_max_ms = 0;
+
+	if (pthread_create (&journal_flusher, NULL, journal_flush_loop, NULL) != 0)
+		return -1;
+
+	return 0;
+}
+
+long journal_recovered (journal_record **records)
+{
+	*records = journal_pending.data();
+	return journal_pending.size();
+}
+
+unsigned long journal_last_seq ()
+{
+	return journal_max_seq;
+}
+
+static void journal_append (int type, unsigned long seq, int duration)
+{
+	journal_record record;
+	record.type = type;
+	record.duration = duration;
+	record.seq = seq;
+
+	pthread_mutex_lock (&journal_lock);
+	journal_batch.push_back (record);
+	if (sync_jobs > 0 && (int) journal_batch.size() >= sync_jobs)
+		pthread_cond_signal (&journal_cond);
+	pthread_mutex_unlock (&journal_lock);
+}
+
+void journal_deposit (unsigned long seq, int duration)
+{
+	if (journal_fd >= 0)
+		journal_append (JOURNAL_DEPOSIT, seq, duration);
+}
+
+void journal_complete (unsigned long seq)
+{
+	if (journal_fd >= 0)
+		journal_append (JOURNAL_COMPLETE, seq, 0);
+}
+
+void journal_close ()
+{
+	if (journal_fd < 0)
+		return;
+
+	pthread_mutex_lock (&journal_lock);
+	journal_stop = true;
+	pthread_cond_signal (&journal_cond);
+	pthread_mutex_unlock (&journal_lock);
+	pthread_join (journal_flusher, NULL);
+
+	close (journal_fd);
+	journal_fd = -1;
+}
+
+void print_journal_statistics ()
+{
+	printf("Journal: recovered %ld records %ld commits %ld bytes %ld fsync total %.2f ms avg %.3f ms max %.3f ms (every %d jobs / %d ms)\n",
+		(long) journal_pending.size(), records_written, commits, bytes_written, fsync_total_ms,
+		commits ? fsync_total_ms / commits : 0.0, fsync_max_ms, sync_jobs, sync_ms);
+}
@@ -0,0 +1,31 @@
+/******************************************************************
+ * Header file for the write-ahead journal. Deposits and completions
+ * are appended to a file in batches which are group-committed by a
+ * background thread, either every N records or every T milliseconds.
+ ******************************************************************/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "helper.h"
+
+#define JOURNAL_DEPOSIT		1
+#define JOURNAL_COMPLETE	2
+
+/* Structure of a single record as stored in the journal file */
+struct journal_record
+{
+	int type;
+	int duration;
+	unsigned long seq;
+};
+
+int journal_open (const char *path, int sync_every_jobs, int sync_every_ms);
+long journal_recovered (journal_record **records);
+unsigned long journal_last_seq ();
+void journal_deposit (unsigned long seq, int duration);
+void journal_complete (unsigned long seq);
+void journal_close ();
+void print_journal_statistics ();
+
+#endif
@@ -0,0 +1,143 @@
+/******************************************************************
+ * The lock contention profiler:
+ * lock_profile_start - Starts profiling acquisitions of a semaphore
+ * lock_profile_watches - Tells whether an operation set uses it
+ * lock_profile_op_many - Performs such a set and accounts for it
+ * print_lock_statistics - Reports the accounting of every call site
+ *
+ * The mutex is taken try-then-wait: a set that also takes item or
+ * space is first attempted as a whole, and if that fails the other
+ * semaphores are waited for on their own before mutex, so an empty
+ * or full buffer is never mistaken for contention. Acquisitions and
+ * hold times are recorded while the mutex is held, so the per-site
+ * counters only need atomic updates for attempts that gave up.
+ ******************************************************************/
+
+#include "lockprof.h"
+#include "sync.h"
+
+/* Accounting of one call site */
+struct site_statistics
+{
+	const char *name;
+	long acquired;
+	long contended;		//the mutex was busy at the first attempt
+	long busy;		//non-blocking attempts that found the mutex busy
+	latency_histogram wait;	//contended acquisitions only
+	latency_histogram hold;
+};
+
+bool lock_profile_on = false;
+__thread int lock_site = LOCK_DEPOSIT;
+
+static int watched = -1;
+static site_statistics sites[LOCK_SITES];
+static const char *site_names[LOCK_SITES] = { "Producer deposit", "Consumer fetch", "Drop oldest", "Spill", "Ingest", "Recovery" };
+
+/* Site and acquisition time of the mutex held by the calling thread */
+static __thread site_statistics *held_site = NULL;
+static __thread long long held_since = 0;
+
+void lock_profile_start (int mutex_num)
+{
+	for (int s = 0; s < LOCK_SITES; s++)
+		sites[s].name = site_names[s];
+	watched = mutex_num;
+	lock_profile_on = true;
+}
+
+bool lock_profile_watches (const sem_op_entry *ops, int count)
+{
+	for (int i = 0; i < count; i++)
+		if (ops[i].num == watched)
+			return true;
+	return false;
+}
+
+/* Function used to account for an acquisition, with the mutex held */
+static void acquired (site_statistics *site, long long waited, bool contended)
+{
+	site->acquired++;
+	if (contended)
+	{
+		site->contended++;
+		histogram_record(&site->wait, waited);
+	}
+	held_site = site;
+	held_since = now_ns();
+}
+
+int lock_profile_op_many (const sem_op_entry *ops, int count, int time_delay)
+{
+	sem_op_entry others[count], take = { (short unsigned int) watched, -1 };
+	int other_count = 0;
+	bool releasing = false;
+
+	for (int i = 0; i < count; i++)
+		if (ops[i].num != watched)
+			others[other_count++] = ops[i];
+		else
+			releasing = (ops[i].delta > 0);
+
+	//the hold ends with the release, which is recorded while the mutex is still held
+	if (releasing)
+	{
+		if (held_since != 0)
+			histogram_record(&held_site->hold, now_ns() - held_since);
+		held_since = 0;
+		return sync_ops->op_many(ops, count, time_delay);
+	}
+
+	site_statistics *site = &sites[(lock_site >= 0 && lock_site < LOCK_SITES) ? lock_site : LOCK_DEPOSIT];
+	if (sync_ops->op_many(ops, count, 0) == 0)
+	{
+		acquired(site, 0, false);
+		return 0;
+	}
+	if (time_delay == 0)
+	{
+		int error = errno;
+		if (sync_ops->get_value(watched) == 0)
+			__sync_fetch_and_add(&site->busy, 1);
+		errno = error;
+		return -1;
+	}
+
+	//time_delay only applies to item or space, a busy mutex is always waited for
+	if (other_count > 0)
+	{
+		if (sync_ops->op_many(others, other_count, time_delay) != 0)
+			return -1;
+		if (sync_ops->op_many(&take, 1, 0) == 0)
+		{
+			acquired(site, 0, false);
+			return 0;
+		}
+	}
+
+	long long started = now_ns();
+	sync_ops->op_many(&take, 1, -1);
+	acquired(site, now_ns() - started, true);
+	return 0;
+}
+
+void print_lock_statistics ()
+{
+	char name[64];
+
+	printf("Lock contention on the queue mutex:\n");
+	for (int s = 0; s < LOCK_SITES; s++)
+	{
+		site_statistics *site = &sites[s];
+		long attempts = site->acquired + site->busy;
+		if (attempts == 0)
+			continue;
+
+		printf("  %s: attempts %ld acquired %ld contended %ld (%.1f%%) gave up busy %ld\n", site->name, attempts, site->acquired,
+			site->contended, site->acquired ? 100.0 * site->contended / site->acquired : 0.0, site->busy);
+		snprintf(name, sizeof(name), "  %s wait when contended", site->name);
+		print_histogram(name, &site->wait);
+		snprintf(name, sizeof(name), "  %s hold", site->name);
+		print_histogram(name, &site->hold);
+	}
+}
@@ -0,0 +1,41 @@
+/******************************************************************
+ * Header file for the lock contention profiler. With profiling on,
+ * every acquisition of the queue mutex is made as a non-blocking
+ * attempt followed, only if that fails, by a blocking wait. Each
+ * acquisition is charged to the call site the thread is taking the
+ * mutex for, which keeps attempts, contended acquisitions and the
+ * wait and hold time histograms reported at shutdown.
+ ******************************************************************/
+
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include "helper.h"
+
+/* Call sites taking the mutex */
+enum lock_site
+{
+	LOCK_DEPOSIT,		//producer depositing a job
+	LOCK_FETCH,		//consumer fetching a job
+	LOCK_DROP_OLDEST,	//producer evicting the oldest job
+	LOCK_SPILL,		//producer spilling a job to disk
+	LOCK_INGEST,		//ingestion front-end depositing a frame
+	LOCK_RECOVERY,		//journal recovery requeueing a job
+	LOCK_SITES
+};
+
+extern bool lock_profile_on;
+extern __thread int lock_site;
+
+void lock_profile_start (int mutex_num);
+bool lock_profile_watches (const sem_op_entry *ops, int count);
+int lock_profile_op_many (const sem_op_entry *ops, int count, int time_delay);
+void print_lock_statistics ();
+
+/* Function used to tag the calling thread's next acquisitions with site */
+static inline void lock_site_set (int site)
+{
+	lock_site = site;
+}
+
+#endif
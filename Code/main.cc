@@ -4,40 +4,184 @@
  ******************************************************************/
 
 #include "helper.h"
+#include "journal.h"
+#include "queue.h"
+#include "arrival.h"
+#include "trace.h"
+#include "sync.h"
+#include "ingest.h"
+#include "results.h"
+#include "dag.h"
+#include "cancel.h"
+#include "fair.h"
+#include "quota.h"
+#include "pipeline.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "perfcount.h"
+#include "lockprof.h"
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
-/* Structure for jobs which are to be inserted in the circular quque */
-struct job
+/* Epoll set a consumer waits on with the eventfd backend. It holds the item
+ * eventfd and an idle timer, and can hold any other descriptor the consumer serves. */
+struct item_waiter
 {
-	int job_id;
-	int duration; //in seconds
-};
-
-/* Structure used to implement a circular queue */
-struct circular_queue
-{
-	int head;
-	int tail;
-	int array_size;
-	job *data;
+	int epoll_fd;
+	int timer_fd;
 };
 
 /* Function prototype definitions */
-void initializeQueue();
 void *producer (void *id);
 void *consumer (void *id);
+void *recovery_producer (void *arg);
+void *autoscaler (void *arg);
+void *pipeline_stage (void *id);
+void *broadcast_member (void *id);
+bool claim_retirement();
+int free_consumer_slot();
 int produce(int min, int max);
-void deposit_item(job new_job);
-job fetch_item();
 void consume(int duration);
 int initialize_required_semaphores();
 void setup_variables(char **argv);
+int setup_options(int argc, char **argv);
+int acquire_space(int producer_id, job new_job);
+void print_backpressure_statistics();
+void open_item_waiter(item_waiter *waiter);
+void close_item_waiter(item_waiter *waiter);
+int wait_for_item(item_waiter *waiter, int time_delay);
+void deposit_batch(const int32_t *durations, int count);
+int collect_results(int producer_id, int timeout_ms, long limit);
+void post_result(job *finished, int consumer_id, int status);
+void execute_job(job *current, int consumer_id);
+void deposit_released(int producer_id);
+long long deadline_after(long long start_ns);
+int space_of(int producer_id);
+int take_space(int producer_id, int time_delay);
+void release_space(int producer_id);
+long long wait_clock();
+
+/* Policies applied by producers when the buffer has no space left */
+enum backpressure_policy { POLICY_BLOCK, POLICY_DROP, POLICY_DROP_OLDEST, POLICY_SPILL };
 
-/* Global variable used for identifying semaphores and the semaphore id set */
-int item = 0, space = 1, mutex = 2, sem_id;
+/* Outcome of acquire_space(). SPACE_ACQUIRED leaves the caller holding mutex as well. */
+enum space_result { SPACE_ACQUIRED, SPACE_TIMEOUT, SPACE_DROPPED, SPACE_OVERWRITTEN, SPACE_SPILLED, SPACE_HELD, SPACE_PUBLISHED };
+
+/* Counters kept by each backpressure policy, used to size buffer_size */
+struct backpressure_statistics
+{
+	long deposited;
+	long blocked;		//block: deposits that had to wait for space
+	long timeouts;		//block: producers that gave up after the deadline
+	long dropped;		//drop: jobs rejected because the buffer was full
+	long overwritten;	//drop-oldest: queued jobs replaced by newer ones
+	long spilled;		//spill: jobs written to the spill segment
+	long refilled;		//spill: jobs moved back from the spill segment
+	long spill_peak;	//spill: largest number of jobs held on disk
+};
+
+/* Global variable used for identifying semaphores within the synchronization backend */
+int item = 0, space = 1, mutex = 2;
+
+/* Combined operations, each applied atomically with a single semop call on SysV.
+ * The ones on space are built by take_space and release_space, as fair queueing
+ * gives every producer its own space semaphore after the first three. */
+const sem_op_entry take_item_and_mutex[] = { {(short unsigned int) item, -1}, {(short unsigned int) mutex, -1} };
+const sem_op_entry release_mutex_and_item[] = { {(short unsigned int) mutex, 1}, {(short unsigned int) item, 1} };
 
 /* Global variables used for operation of the consumers and producers */
 int number_of_producers, number_of_consumers, jobs_per_producer, buffer_size;
-circular_queue my_queue;
+const char *ring_path = NULL;
+bool huge_pages = false;
+
+/* Global variables used for the sysv backend: SEM_UNDO on the hot path and the
+ * optional ftok path/instance the key is derived from (private set by default).
+ * A fixed key lets a stale set be found and reclaimed; it is not a way for another
+ * process to attach, as every run creates the set exclusively. */
+bool sem_undo = true;
+const char *sem_key_path = NULL;
+int instance = 0;
+
+/* Global variables used for the backpressure policy and its counters */
+backpressure_policy policy = POLICY_BLOCK;
+int space_deadline = 20;
+const char *spill_path = NULL;
+backpressure_statistics bp_stats;
+
+/* Global variables used for the write-ahead journal */
+const char *journal_path = NULL;
+int journal_sync_jobs = 64, journal_sync_ms = 100;
+unsigned long next_seq = 0;
+
+/* Global variables used by the consumer autoscaler. Consumers are spawned and
+ * retired between min_consumers and max_consumers, based on queue occupancy and
+ * the time jobs wait in the queue. */
+int min_consumers = 0, max_consumers = 0;
+int scale_interval_ms = 500, scale_samples = 3;
+int scale_up_occupancy = 75, scale_down_occupancy = 25, target_wait_ms = 0;
+pthread_t *consumer_td;
+int spawned_consumers = 0, active_consumers = 0, retire_requests = 0;
+bool *consumer_exited;	//the consumer in this slot has left and can be joined
+long long wait_total_ns = 0;
+long wait_samples = 0;
+bool producers_done = false;
+
+/* Latency measured from the intended arrival time of each job (open-loop arrivals) */
+latency_histogram start_latency, completion_latency;
+
+/* Global variables used by the completion path: off, async (producers collect results
+ * as they come back) or sync (each producer awaits its job's result before the next) */
+enum completion_mode { COMPLETIONS_OFF, COMPLETIONS_ASYNC, COMPLETIONS_SYNC };
+completion_mode completions = COMPLETIONS_OFF;
+latency_histogram round_trip;
+
+/* Global variables used for dependencies: each job depends on up to dag_deps jobs
+ * picked among the last dag_window jobs of the same producer (0 turns it off) */
+int dag_deps = 0, dag_window = 4;
+
+/* Global variables used for stale work: jobs expire job_deadline seconds after they
+ * are produced (0 for never) and producers cancel cancel_percent of their jobs */
+int job_deadline = 0, cancel_percent = 0;
+
+/* Global variables used for fair queueing: one sub-queue per producer served by
+ * deficit round robin, with fair_quantum seconds of job duration per round */
+bool fair_queueing = false;
+int fair_quantum = 10;
+
+/* Global variables used for quotas: colon-separated weights of the producer groups
+ * sharing the buffer, e.g. "2:1:1" (NULL turns quotas off) */
+const char *quota_weights = NULL;
+
+/* Global variables used for pipeline mode: every job goes through pipeline_stages
+ * stages, one thread each, which split its duration (0 uses consumers instead) */
+int pipeline_stages = 0;
+
+/* Global variables used for broadcast mode: every job is seen by each of the
+ * broadcast_groups groups, made of number_of_consumers members (0 turns it off) */
+int broadcast_groups = 0;
+
+/* Global variables used for the metrics snapshot file (NULL turns it off) */
+const char *metrics_path = NULL;
+int metrics_interval_ms = 1000;
+
+/* Global variables used for the timeline trace (NULL turns it off) */
+const char *timeline_path = NULL;
+long timeline_events = 100000;
+
+/* Global variable used to turn on the per-thread hardware counters */
+bool perf_counters = false;
+
+/* Global variable used to turn on the contention profiler of the mutex semaphore */
+bool lock_profile = false;
+
+/* Global variables used by the ingestion front-end */
+const char *ingest_address = NULL;
+int ingest_idle = 20;
+int ingest_max_duration = 10;	//longest job accepted from outside, like the producers'
+
+/* Global variables used to record and replay job streams */
+const char *record_path = NULL, *replay_path = NULL;
+double replay_speed = 1.0;
 
 int main (int argc, char **argv)
 {
@@ -47,14 +191,14 @@ int main (int argc, char **argv)
 	srand(time(NULL));
 
 	//Verifications of number of arguments
-	if(argc != 5)
+	if(argc < 5)
 	{
 		cerr <<	"Incorrect number of arguments!" << endl;
 		return INCORRECT_NUMBER_OF_ARGUMENTS;
 	}
 	
 	//Verification of argument values
-	for(int i = 1; i < argc; i++)
+	for(int i = 1; i < 5; i++)
 	{
 		if(check_arg(argv[i]) == -1)
 		{
@@ -64,54 +208,239 @@ int main (int argc, char **argv)
 		}
 	}
 
-	//Generate a semaphore ID from a created set of semaphores
-	sem_id = sem_create(SEM_KEY, 3);
+	//Optional "name=value" arguments follow the four positional ones
+	if (setup_options(argc, argv) != NO_ERROR)
+		return INVALID_OPTION;
+
+	//Create the set of semaphores with the selected synchronization backend
+	sync_set_key(sem_key_path, instance);
+	int created = sync_create(fair_queueing ? 3 + check_arg(argv[3]) + 1 : 3);
 	
-	//Verify semaphores have been created correctly. Handle_semget_error returns an appropriate
+	//Verify semaphores have been created correctly. print_sync_error returns an appropriate
 	//message if the semaphore set wasn't created successfully.
-	if (sem_id == -1)
+	if (created == -1)
 	{
-		print_semget_error (errno);
+		print_sync_error (errno, true);
 		return errno;
 	}	
 
 	setup_variables(argv);
+	sem_set_undo(sem_undo);
+
+	//the initial pool is kept within the autoscaler bounds
+	if (number_of_consumers < min_consumers)
+		number_of_consumers = min_consumers;
+	if (number_of_consumers > max_consumers)
+		number_of_consumers = max_consumers;
 
 	//Declaration for number of POSIX threads required for producers and consumers
 	pthread_t producer_td[number_of_producers];
-	pthread_t consumer_td[number_of_consumers];
+	consumer_td = new pthread_t[max_consumers];
+	consumer_exited = new bool[max_consumers]();
 	
+	//The queue is set up first as a persistent ring file may already hold jobs
+	if (initializeQueue(buffer_size, ring_path, huge_pages) != 0)
+	{
+		cerr << "Unable to set up the queue: " << strerror(errno) << endl;
+		sync_close();
+		return errno;
+	}
+	if (huge_pages)
+		printf("Queue: %d jobs backed by %s\n", buffer_size, queue_page_kind());
+	if (pipeline_stages > 0)
+		pipeline_init(pipeline_stages);
+	else if (broadcast_groups > 0)
+		broadcast_init(broadcast_groups, number_of_consumers / broadcast_groups);
+
 	//Semaphore initialization which verifies for system call errors and if found the program outputs 
 	//an appropriate message then closes the semaphore set.
 	if (initialize_required_semaphores() != NO_ERROR)
 	{
-		print_semctl_error(errno);
-		sem_close(sem_id);
+		print_sync_error(errno, false);
+		sync_close();
 		return errno;	
 	}
 
-	initializeQueue();
+	//Every acquisition of mutex from here on is charged to its call site
+	if (lock_profile)
+		lock_profile_start(mutex);
+
+	//The spill policy keeps overflow jobs in a disk-backed segment
+	if (policy == POLICY_SPILL && spill_open(spill_path, sizeof(job)) != 0)
+	{
+		cerr << "Unable to open the spill segment: " << strerror(errno) << endl;
+		sync_close();
+		return errno;
+	}
  
+	//Replay the journal and requeue the jobs which never completed
+	pthread_t recovery_td;
+	if (journal_path != NULL)
+	{
+		if (journal_open(journal_path, journal_sync_jobs, journal_sync_ms) != 0)
+		{
+			cerr << "Unable to open the journal '" << journal_path << "': " << strerror(errno) << endl;
+			sync_close();
+			return errno;
+		}
+		next_seq = journal_last_seq();
+		pthread_create (&recovery_td, NULL, recovery_producer, NULL);
+	}
+
+	//Dependency nodes are numbered by sequence, starting with the first new job
+	if (dag_deps > 0)
+	{
+		long capacity = (long) jobs_per_producer * number_of_producers;
+		for (producer_id = 1; replay_path != NULL && producer_id <= number_of_producers; producer_id++)
+			capacity += trace_replay_jobs(producer_id);
+		dag_init(next_seq + 1, capacity);
+	}
+
+	//Tombstones are kept for every job a producer may cancel
+	if (cancel_percent > 0)
+	{
+		long capacity = (long) jobs_per_producer * number_of_producers;
+		for (producer_id = 1; replay_path != NULL && producer_id <= number_of_producers; producer_id++)
+			capacity += trace_replay_jobs(producer_id);
+		cancel_init(capacity);
+	}
+
+	//Every producer gets a result ring for the jobs that can be in flight between two collections:
+	//the buffer, one job per consumer and the one deposited since; consumers wait when it is full
+	if (completions != COMPLETIONS_OFF)
+		results_init(number_of_producers, buffer_size + max(number_of_consumers, max_consumers) + 1);
+
+	//External producers deposit through the ingestion front-end
+	if (ingest_address != NULL && ingest_start(ingest_address, ingest_idle, ingest_max_duration, deposit_batch) != 0)
+	{
+		cerr << "Unable to listen on '" << ingest_address << "': " << strerror(errno) << endl;
+		sync_close();
+		return errno;
+	}
+
+	//Counter blocks for every producer and every consumer the autoscaler may spawn
+	if (metrics_path != NULL && metrics_start(metrics_path, metrics_interval_ms, number_of_producers + max_consumers) != 0)
+	{
+		cerr << "Unable to write the metrics file '" << metrics_path << "': " << strerror(errno) << endl;
+		sync_close();
+		return errno;
+	}
+
+	//Span buffers for every thread that takes part in moving jobs
+	if (timeline_path != NULL && timeline_start(timeline_path, number_of_producers + max_consumers, timeline_events) != 0)
+	{
+		cerr << "Unable to write the timeline '" << timeline_path << "': " << strerror(errno) << endl;
+		sync_close();
+		return errno;
+	}
+
+	//Counter records for every producer and every consumer the autoscaler may spawn
+	if (perf_counters)
+		perf_init(number_of_producers + max_consumers);
+
+	//Recorded and replayed streams are timed relative to the start of the producers
+	trace_start(now_ns());
+
 	//Create POSIX threads for producers
 	for(producer_id = 0; producer_id < number_of_producers; producer_id++)
 		pthread_create (&producer_td[producer_id], NULL, producer, (void *) (intptr_t) (producer_id + 1));
 	
 	//Create POSIX threads for consumers				
 	for(consumer_id = 0; consumer_id < number_of_consumers; consumer_id++)
-		pthread_create (&consumer_td[consumer_id], NULL, consumer, (void *) (intptr_t) (consumer_id + 1));
+	{
+		__sync_fetch_and_add(&active_consumers, 1);
+		pthread_create (&consumer_td[consumer_id], NULL, (pipeline_stages > 0) ? pipeline_stage : (broadcast_groups > 0) ? broadcast_member : consumer,
+			(void *) (intptr_t) (consumer_id + 1));
+	}
+	spawned_consumers = number_of_consumers;
+
+	//The autoscaler only runs when the consumer bounds leave room to scale
+	pthread_t autoscaler_td;
+	if (max_consumers > min_consumers)
+		pthread_create (&autoscaler_td, NULL, autoscaler, NULL);
 
 	//Wait for producer threads to terminate
 	for(producer_id = 0; producer_id < number_of_producers; producer_id++)
 		pthread_join (producer_td[producer_id], NULL);
 
+	if (journal_path != NULL)
+		pthread_join (recovery_td, NULL);
+
+	//The listener stops once it has had no connection for ingest_idle seconds
+	if (ingest_address != NULL)
+		ingest_wait();
+
+	//No more consumers are spawned once every producer has finished
+	producers_done = true;
+	if (pipeline_enabled())
+		pipeline_close();
+	if (max_consumers > min_consumers)
+		pthread_join (autoscaler_td, NULL);
+
 	//Wait for consumer threads to terminate
-	for(consumer_id = 0; consumer_id < number_of_consumers; consumer_id++)
+	for(consumer_id = 0; consumer_id < spawned_consumers; consumer_id++)
 		pthread_join (consumer_td[consumer_id], NULL);
+	delete [] consumer_td;
+	delete [] consumer_exited;
+
+	metrics_stop();
+	if (timeline_dump() != 0)
+		cerr << "Unable to write the timeline '" << timeline_path << "': " << strerror(errno) << endl;
+	journal_close();
+	trace_record_close();
 
 	//Destroy semaphore set
-	sem_close(sem_id);
+	sync_close();
 	
-	delete [] my_queue.data;
+	print_backpressure_statistics();
+	if (perf_counters)
+		print_perf_statistics();
+	if (lock_profile)
+		print_lock_statistics();
+	if (journal_path != NULL)
+		print_journal_statistics();
+	if (ingest_address != NULL)
+		print_ingest_statistics();
+	if (cancel_percent > 0 || job_deadline > 0)
+	{
+		print_cancel_statistics();
+		cancel_destroy();
+	}
+	if (dag_deps > 0)
+	{
+		print_dag_statistics();
+		dag_destroy();
+	}
+	if (pipeline_enabled())
+	{
+		print_pipeline_statistics();
+		pipeline_destroy();
+	}
+	if (quota_enabled())
+	{
+		print_quota_statistics();
+		quota_destroy();
+	}
+	if (fair_queueing)
+	{
+		print_fair_statistics();
+		fair_destroy();
+	}
+	if (completions != COMPLETIONS_OFF)
+	{
+		print_histogram("Round trip from production to result", &round_trip);
+		if (results_lost() > 0)
+			printf("Results lost: %ld\n", results_lost());
+		results_destroy();
+	}
+	if (arrivals.process != ARRIVAL_CLOSED || replay_path != NULL)
+	{
+		print_histogram("Latency from intended arrival to start", &start_latency);
+		print_histogram("Latency from intended arrival to completion", &completion_latency);
+	}
+
+	spill_close();
+	destroyQueue();
 
  	return NO_ERROR;
 }
@@ -122,49 +451,199 @@ void *producer(void *id)
 	int producer_id = (intptr_t) id;
 	bool timeout = false;
 	job temp_job;
+	metrics_register("producer", producer_id);
+	timeline_register("producer", producer_id);
+	perf_thread_start("producer", producer_id);
+	lock_site_set(LOCK_DEPOSIT);
+	arrival_state arrival;
+
+	arrival_start(&arrival, producer_id);
+
+	//a replayed trace decides how many jobs each producer deposits
+	long jobs = (replay_path != NULL) ? trace_replay_jobs(producer_id) : jobs_per_producer;
+	long long replay_arrival = 0;
+	long outstanding = 0;
+
+	//the producer's most recent jobs, candidates for the next job's predecessors
+	unsigned long recent[dag_window > 0 ? dag_window : 1];
+	int recent_count = 0;
+	unsigned int dag_seed = producer_id;
+	unsigned int cancel_seed = producer_id * 7919;
 
 	//loop
-	for(int i = 0; (i < jobs_per_producer); i++)
+	for(long i = 0; (i < jobs); i++)
 	{
-		//produce job duration		
-		int duration = produce(1, 10);
+		long long produce_begin = wait_clock();
+
+		//produce job duration, or take it from the trace being replayed
+		int duration;
+		if (replay_path != NULL)
+			trace_replay_job(producer_id, i, &duration, &replay_arrival);
+		else
+			duration = produce(1, 10);
+
+		temp_job.job_id = 0;
+		temp_job.duration = duration;
+		temp_job.seq = __sync_add_and_fetch(&next_seq, 1);
+		temp_job.producer_id = producer_id;
+
+		//open-loop producers follow an absolute schedule and stamp the job with its
+		//intended arrival time, so time lost blocking is charged to the job's latency
+		if (replay_path != NULL)
+		{
+			temp_job.produced_ns = replay_arrival;
+			arrival_sleep_until(temp_job.produced_ns);
+		}
+		else if (arrivals.process != ARRIVAL_CLOSED)
+		{
+			temp_job.produced_ns = arrival_next(&arrival);
+			arrival_sleep_until(temp_job.produced_ns);
+		}
+		else
+		{
+			//sleep 1-5 seconds before depositing job
+			sleep(produce(1, 5));		
+			temp_job.produced_ns = now_ns();
+		}
+		temp_job.deadline_ns = deadline_after(temp_job.produced_ns);
+		trace_record_job(producer_id, temp_job.produced_ns, duration);
+		timeline_span("produce", produce_begin);
+
+		//a job with pending predecessors is held by the scheduler instead of being deposited
+		bool held = false;
+		if (dag_enabled())
+		{
+			unsigned long predecessors[dag_deps];
+			int count = (recent_count > 0) ? rand_r(&dag_seed) % (dag_deps + 1) : 0;
+			for (int p = 0; p < count; p++)
+				predecessors[p] = recent[rand_r(&dag_seed) % recent_count];
+			held = !dag_add_job(&temp_job, predecessors, count);
+			recent[i % dag_window] = temp_job.seq;
+			if (recent_count < dag_window)
+				recent_count++;
+		}
+
+		//perform down operation on semaphore space as dictated by the backpressure policy
+		int result;
+		perf_section_begin();
+		if (held)
+			result = SPACE_HELD;
+		else if (pipeline_enabled())
+		{
+			//publishing waits for the slowest reader to free the slot
+			long long publish_begin = wait_clock();
+			result = (pipeline_publish(&temp_job, space_deadline) == 0) ? SPACE_PUBLISHED : SPACE_TIMEOUT;
+			timeline_span("deposit", publish_begin);
+		}
+		else
+			result = acquire_space(producer_id, temp_job);
 
-		//sleep 1-5 seconds before depositing job
-		sleep(produce(1, 5));		
+		//every job accepted into the system is journaled before it can be consumed
+		if (result == SPACE_ACQUIRED || result == SPACE_HELD)
+			journal_deposit(temp_job.seq, temp_job.duration);
+		//a job deposited under mutex ends its section once mutex is released below
+		if (result != SPACE_ACQUIRED)
+			perf_section_end();
+		if (result == SPACE_TIMEOUT)
+			local_counters->timeouts++;
+		else if (result != SPACE_DROPPED)
+		{
+			local_counters->produced++;
+			perf_job_done();
+		}
 
-		//perform down operation on semaphore space and store timeout state
-		timeout = sem_timed_wait (sem_id, space, 20);
+		//a job that never runs must not block the jobs that depend on it
+		if (result == SPACE_DROPPED || result == SPACE_TIMEOUT)
+		{
+			dag_complete(temp_job.seq);
+			deposit_released(producer_id);
+		}
 
 		//if operation times out then break loop
-		if (timeout)
+		if (result == SPACE_TIMEOUT)
 		{
+			timeout = true;
 			printf("Producer(%d): terminated due to a timeout\n", producer_id);
 			break;		
 		}
+		else if (result == SPACE_DROPPED)
+		{
+			printf("Producer(%d): Job dropped (buffer full) duration %d\n", producer_id, duration);
+			continue;
+		}
+		else if (result == SPACE_SPILLED)
+			printf("Producer(%d): Job spilled to disk duration %d\n", producer_id, duration);
+		else if (result == SPACE_OVERWRITTEN)
+			printf("Producer(%d): Job overwrote the oldest job duration %d\n", producer_id, duration);
+		else if (result == SPACE_HELD)
+			printf("Producer(%d): Job seq %lu duration %d held until its predecessors complete\n", producer_id, temp_job.seq, duration);
+		else if (result == SPACE_PUBLISHED)
+		{
+			//publishing takes no mutex, so producers count concurrently
+			__sync_fetch_and_add(&bp_stats.deposited, 1);
+			printf("Producer(%d): Job ID %d duration %d\n", producer_id, temp_job.job_id, temp_job.duration);
+		}
+		else
+		{
+			//assign job id based on queue tail and create new job with produced job id and duration
+			//(acquire_space already took mutex together with space)
+			long long deposit_begin = wait_clock();
+			temp_job.job_id = next_job_id(temp_job.producer_id);
 	
-		//perform down operation for mutex to protect the buffer
-		sem_wait (sem_id, mutex);
-		
-		//assign job id based on queue tail and create new job with produced job id and duration
-		temp_job.job_id = (my_queue.tail + 1);
-		temp_job.duration = duration;
-	
-		//deposit job on the queue
-		deposit_item(temp_job);
+			//deposit job on the queue
+			deposit_item(temp_job);
+			bp_stats.deposited++;
 
-		//perform up operation for mutex and item semaphores
-		sem_signal (sem_id, mutex);
-		sem_signal (sem_id, item);
+			//perform up operation for mutex and item semaphores in one call
+			sync_op_many(release_mutex_and_item, 2, -1);
+			perf_section_end();
+			timeline_span("deposit", deposit_begin);
 
-		//Output details of producer and the deposited job
-		printf("Producer(%d): Job ID %d duration %d\n", producer_id, temp_job.job_id, temp_job.duration);
+			//Output details of producer and the deposited job
+			printf("Producer(%d): Job ID %d duration %d\n", producer_id, temp_job.job_id, temp_job.duration);
+		}
+
+		//the producer loses interest in some of its queued jobs
+		if (cancel_percent > 0 && (int) (rand_r(&cancel_seed) % 100) < cancel_percent && cancel_job(temp_job.seq))
+			printf("Producer(%d): Job seq %lu cancelled\n", producer_id, temp_job.seq);
+
+		//every accepted job gets a result; sync producers await it like a future
+		if (completions == COMPLETIONS_SYNC)
+		{
+			job_result answer;
+			if (results_await(producer_id, temp_job.seq, &answer, 60000) == 0)
+			{
+				if (answer.status != RESULT_COMPLETED)
+					printf("Producer(%d): Job seq %lu was skipped without running\n", producer_id, answer.seq);
+				else
+				{
+					histogram_record(&round_trip, answer.completed_ns - answer.produced_ns);
+					printf("Producer(%d): result for Job ID %d from Consumer(%d)\n", producer_id, answer.job_id, answer.consumer_id);
+				}
+			}
+			else
+				outstanding++;
+		}
+		else if (completions == COMPLETIONS_ASYNC)
+			outstanding += 1 - collect_results(producer_id, 0, -1);
+
+		//jobs whose predecessor was evicted while making room are deposited here
+		deposit_released(producer_id);
 	}
 	
 	//if loop is broken without a timeout then output message
 	if(!timeout)
 		printf("Producer(%d): No more jobs to generate\n", producer_id);
 
+	//wait for the results of the jobs still in flight
+	if (outstanding > 0)
+	{
+		outstanding -= collect_results(producer_id, 60000, outstanding);
+		printf("Producer(%d): all results collected%s\n", producer_id, outstanding > 0 ? " (some timed out)" : "");
+	}
+
 	//close pthread
+	perf_thread_stop();
  	pthread_exit(0);
 }
 
@@ -173,34 +652,627 @@ void *consumer (void *id)
 	//Assign consumer id
 	int consumer_id = (intptr_t) id;
 	job temp_job;
+	metrics_register("consumer", consumer_id);
+	timeline_register("consumer", consumer_id);
+	perf_thread_start("consumer", consumer_id);
+	lock_site_set(LOCK_FETCH);
 
-	//loop consumer until it times out due to no item being available for 20 seconds
-	while(sem_timed_wait (sem_id, item, 20) == 0)
-	{
-		//perform down operation on mutex
-		sem_wait (sem_id, mutex);
+	item_waiter waiter;
+	open_item_waiter(&waiter);
 
+	//loop consumer until it times out due to no item being available for 20 seconds,
+	//item and mutex are taken together
+	while(wait_for_item (&waiter, 20) == 0)
+	{
 		//fetch job from queue
+		perf_section_begin();
+		long long fetch_begin = wait_clock();
 		temp_job = fetch_item();
-	
-		//perform up operation on mutex and space
-		sem_signal (sem_id, mutex);
-		sem_signal (sem_id, space);
-
-		//print consumption status and details
-		printf("Consumer(%d): Job ID %d executing sleep duration %d\n", consumer_id, temp_job.job_id, temp_job.duration);
-		
-		//perform job consumption (sleep for duration)
-		sleep(temp_job.duration);
-	
-		//print consumption status after job completion
-		printf("Consumer(%d): Job ID %d completed\n", consumer_id, temp_job.job_id);
+
+		//the freed slot is handed straight to a spilled job if there is one
+		job spilled_job;
+		if (policy == POLICY_SPILL && spill_pop(&spilled_job) == 0)
+		{
+			spilled_job.job_id = next_job_id(spilled_job.producer_id);
+			deposit_item(spilled_job);
+			bp_stats.refilled++;
+			bp_stats.deposited++;
+			sync_op_many (release_mutex_and_item, 2, -1);
+		}
+		else
+		{
+			//perform up operation on mutex and space in one call
+			release_space(temp_job.producer_id);
+		}
+		perf_section_end();
+		timeline_span("fetch", fetch_begin);
+
+		execute_job(&temp_job, consumer_id);
+
+		//jobs this completion made runnable are run right away on this consumer
+		while (dag_take_ready(&temp_job))
+			execute_job(&temp_job, consumer_id);
+
+		//leave the pool if the autoscaler asked for a consumer to retire
+		if (claim_retirement())
+		{
+			close_item_waiter(&waiter);
+			printf("Consumer(%d): retired by the autoscaler\n", consumer_id);
+			__sync_fetch_and_sub(&active_consumers, 1);
+			perf_thread_stop();
+			__atomic_store_n(&consumer_exited[consumer_id - 1], true, __ATOMIC_RELEASE);
+			pthread_exit (0);
+		}
 	}
 
+	close_item_waiter(&waiter);
+
 	//print message when loop is broken
 	printf("Consumer(%d): No more jobs left\n", consumer_id);
+	__sync_fetch_and_sub(&active_consumers, 1);
 
 	//close thread
+	perf_thread_stop();
+	__atomic_store_n(&consumer_exited[consumer_id - 1], true, __ATOMIC_RELEASE);
+	pthread_exit (0);
+}
+
+/* Thread used to run one stage of the pipeline. Each stage works on every job for
+ * its share of the job's duration; the first stage also drops cancelled and expired
+ * jobs, which the later stages then pass over, and the last one completes the job. */
+void *pipeline_stage (void *id)
+{
+	int stage_id = (intptr_t) id;
+	bool first = (stage_id == 1), last = (stage_id == pipeline_stages);
+	job *current;
+	bool skipped;
+	metrics_register("stage", stage_id);
+	timeline_register("stage", stage_id);
+	perf_thread_start("stage", stage_id);
+
+	long long wait_begin = wait_clock();
+	while (pipeline_next(stage_id - 1, &current, &skipped))
+	{
+		timeline_span("wait-item", wait_begin);
+		if (first)
+		{
+			long long waited = now_ns() - current->produced_ns;
+			if (arrivals.process != ARRIVAL_CLOSED || replay_path != NULL)
+				histogram_record(&start_latency, waited);
+
+			int skip = cancel_check(current, now_ns());
+			if (skip != SKIP_NONE)
+			{
+				printf("Stage(%d): Job ID %d skipped (%s)\n", stage_id, current->job_id, (skip == SKIP_CANCELLED) ? "cancelled" : "expired");
+				if (completions != COMPLETIONS_OFF)
+					post_result(current, stage_id, (skip == SKIP_CANCELLED) ? RESULT_CANCELLED : RESULT_EXPIRED);
+				skipped = true;
+			}
+		}
+		if (skipped)
+		{
+			perf_section_begin();
+			pipeline_done(stage_id - 1, true);
+			perf_section_end();
+			wait_begin = wait_clock();
+			continue;
+		}
+
+		//perform this stage's share of the job in place, the slot is not copied
+		printf("Stage(%d): Job ID %d executing\n", stage_id, current->job_id);
+		long long execute_begin = wait_clock();
+		usleep(current->duration * 1000000L / pipeline_stages);
+		timeline_span("execute", execute_begin);
+
+		if (last)
+		{
+			printf("Stage(%d): Job ID %d completed\n", stage_id, current->job_id);
+			if (completions != COMPLETIONS_OFF)
+				post_result(current, stage_id, RESULT_COMPLETED);
+			if (arrivals.process != ARRIVAL_CLOSED || replay_path != NULL)
+				histogram_record(&completion_latency, now_ns() - current->produced_ns);
+		}
+		perf_section_begin();
+		pipeline_done(stage_id - 1, false);
+		perf_section_end();
+		local_counters->consumed++;
+		perf_job_done();
+		wait_begin = wait_clock();
+	}
+
+	printf("Stage(%d): No more jobs left\n", stage_id);
+	__sync_fetch_and_sub(&active_consumers, 1);
+	perf_thread_stop();
+	pthread_exit (0);
+}
+
+/* Thread used to run one member of a broadcast group. Every group sees every job and
+ * its members take turns, so each job runs once per group. The group finishing a job
+ * last completes it; the slot is only reused once all groups are done with it. */
+void *broadcast_member (void *id)
+{
+	int reader = (intptr_t) id - 1;
+	int members = number_of_consumers / broadcast_groups;
+	int group_id = reader / members + 1, member_id = reader % members + 1;
+	job *current;
+	bool skipped;
+	metrics_register("group", reader + 1);
+	timeline_register("group", reader + 1);
+	perf_thread_start("group", reader + 1);
+
+	long long wait_begin = wait_clock();
+	while (pipeline_next(reader, &current, &skipped))
+	{
+		timeline_span("wait-item", wait_begin);
+
+		//the slot can be reused as soon as this member is done with it
+		job delivered = *current;
+
+		if (group_id == 1 && (arrivals.process != ARRIVAL_CLOSED || replay_path != NULL))
+			histogram_record(&start_latency, now_ns() - delivered.produced_ns);
+
+		//cancellation and expiry are decided by each group as the job reaches it
+		int skip = cancel_check(&delivered, now_ns());
+		if (skip != SKIP_NONE)
+		{
+			printf("Group(%d.%d): Job ID %d skipped (%s)\n", group_id, member_id, delivered.job_id, (skip == SKIP_CANCELLED) ? "cancelled" : "expired");
+			perf_section_begin();
+			bool last_group = pipeline_done(reader, true);
+			perf_section_end();
+			if (last_group && completions != COMPLETIONS_OFF)
+				post_result(&delivered, reader + 1, (skip == SKIP_CANCELLED) ? RESULT_CANCELLED : RESULT_EXPIRED);
+			wait_begin = wait_clock();
+			continue;
+		}
+
+		printf("Group(%d.%d): Job ID %d executing sleep duration %d\n", group_id, member_id, delivered.job_id, delivered.duration);
+		long long execute_begin = wait_clock();
+		sleep(delivered.duration);
+		timeline_span("execute", execute_begin);
+		printf("Group(%d.%d): Job ID %d completed\n", group_id, member_id, delivered.job_id);
+		local_counters->consumed++;
+		perf_job_done();
+
+		perf_section_begin();
+		bool last_group = pipeline_done(reader, false);
+		perf_section_end();
+		if (last_group)
+		{
+			if (completions != COMPLETIONS_OFF)
+				post_result(&delivered, reader + 1, RESULT_COMPLETED);
+			if (arrivals.process != ARRIVAL_CLOSED || replay_path != NULL)
+				histogram_record(&completion_latency, now_ns() - delivered.produced_ns);
+		}
+		wait_begin = wait_clock();
+	}
+
+	printf("Group(%d.%d): No more jobs left\n", group_id, member_id);
+	__sync_fetch_and_sub(&active_consumers, 1);
+	perf_thread_stop();
+	pthread_exit (0);
+}
+
+/* Thread used to requeue the jobs found unfinished in the journal */
+void *recovery_producer (void *arg)
+{
+	journal_record *records;
+	long count = journal_recovered(&records);
+	job temp_job;
+	lock_site_set(LOCK_RECOVERY);
+
+	for (long i = 0; i < count; i++)
+	{
+		//recovered jobs always wait for space, they are never dropped or spilled
+		take_space(0, -1);
+
+		temp_job.job_id = next_job_id(0);
+		temp_job.duration = records[i].duration;
+		temp_job.seq = records[i].seq;
+		temp_job.produced_ns = now_ns();
+		temp_job.producer_id = 0;
+		temp_job.deadline_ns = deadline_after(temp_job.produced_ns);
+		deposit_item(temp_job);
+		bp_stats.deposited++;
+
+		sync_op_many (release_mutex_and_item, 2, -1);
+
+		printf("Recovery: Job ID %d duration %d replayed from the journal\n", temp_job.job_id, temp_job.duration);
+	}
+
+	pthread_exit (0);
+}
+
+/* Function used to build a consumer's epoll set when the backend exposes eventfds */
+void open_item_waiter(item_waiter *waiter)
+{
+	struct epoll_event event;
+	int item_fd = sync_event_fd(item);
+
+	waiter->epoll_fd = waiter->timer_fd = -1;
+	if (item_fd < 0)
+		return;
+
+	waiter->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	waiter->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	//EPOLLEXCLUSIVE wakes one idle consumer per new job instead of all of them
+	event.events = EPOLLIN | EPOLLEXCLUSIVE;
+	event.data.fd = item_fd;
+	epoll_ctl(waiter->epoll_fd, EPOLL_CTL_ADD, item_fd, &event);
+	event.events = EPOLLIN;
+	event.data.fd = waiter->timer_fd;
+	epoll_ctl(waiter->epoll_fd, EPOLL_CTL_ADD, waiter->timer_fd, &event);
+}
+
+void close_item_waiter(item_waiter *waiter)
+{
+	if (waiter->epoll_fd < 0)
+		return;
+	close(waiter->timer_fd);
+	close(waiter->epoll_fd);
+}
+
+/* Function used to take item and mutex, giving up after time_delay seconds. With the
+ * eventfd backend the consumer sleeps in epoll_wait and then claims the job. */
+int wait_for_item(item_waiter *waiter, int time_delay)
+{
+	struct epoll_event events[2];
+	struct itimerspec idle = { {0, 0}, {time_delay, 0} }, disarm = { {0, 0}, {0, 0} };
+
+	if (waiter->epoll_fd < 0 && !metrics_on && !timeline_on)
+		return sync_op_many (take_item_and_mutex, 2, time_delay);
+
+	//with instrumentation a non-blocking attempt first tells an empty queue from a busy mutex
+	if (waiter->epoll_fd < 0)
+	{
+		if (sync_op_many (take_item_and_mutex, 2, 0) == 0)
+			return 0;
+
+		bool empty = (sync_get_value(item) == 0);
+		long long started = wait_clock();
+		int result = sync_op_many (take_item_and_mutex, 2, time_delay);
+		timeline_span(empty ? "wait-item" : "wait-mutex", started);
+		if (empty)
+		{
+			local_counters->empty_events++;
+			local_counters->blocked_item_ns += metrics_since(started);
+		}
+		else
+			local_counters->blocked_mutex_ns += metrics_since(started);
+		if (result != 0)
+			local_counters->timeouts++;
+		return result;
+	}
+
+	bool armed = false;
+	long long started = 0;
+	for (;;)
+	{
+		//another consumer may win the job between the wake-up and the claim
+		if (sync_try_wait(item) == 0)
+		{
+			local_counters->blocked_item_ns += metrics_since(started);
+			timeline_span("wait-item", started);
+			started = wait_clock();
+			sync_wait (mutex);
+			local_counters->blocked_mutex_ns += metrics_since(started);
+			timeline_span("wait-mutex", started);
+			if (armed)
+				timerfd_settime(waiter->timer_fd, 0, &disarm, NULL);
+			return 0;
+		}
+
+		//the idle timer is only armed once the consumer actually has to sleep
+		if (!armed)
+		{
+			timerfd_settime(waiter->timer_fd, 0, &idle, NULL);
+			armed = true;
+			local_counters->empty_events++;
+			started = wait_clock();
+		}
+
+		int ready = epoll_wait(waiter->epoll_fd, events, 2, -1);
+		for (int i = 0; i < ready; i++)
+			if (events[i].data.fd == waiter->timer_fd)
+			{
+				local_counters->blocked_item_ns += metrics_since(started);
+				timeline_span("wait-item", started);
+				local_counters->timeouts++;
+				errno = EAGAIN;
+				return -1;
+			}
+	}
+}
+
+/* Function used by the ingestion front-end to deposit a frame of jobs. Space for a
+ * whole chunk is taken with a single operation and the consumers are released with
+ * a single item increment. Ingested jobs always wait for space, so a full buffer
+ * pushes back on the socket. */
+void deposit_batch(const int32_t *durations, int count)
+{
+	//semop deltas are shorts and a chunk can never exceed the buffer, or with fair
+	//queueing the shared sub-queue, as space for it could then never be taken; with
+	//quotas it stays within group 0's reservation, as borrowing yields to every owner
+	int chunk_limit = fair_enabled() ? fair_slots(0) : quota_enabled() ? quota_reserved(quota_group(0)) : buffer_size;
+	if (chunk_limit > 32767)
+		chunk_limit = 32767;
+	job temp_job;
+	temp_job.producer_id = 0;
+	lock_site_set(LOCK_INGEST);
+
+	for (int done = 0; done < count; )
+	{
+		int chunk = (count - done < chunk_limit) ? count - done : chunk_limit;
+		const sem_op_entry take[] = { {(short unsigned int) space_of(0), (short) -chunk}, {(short unsigned int) mutex, -1} };
+		const sem_op_entry release[] = { {(short unsigned int) mutex, 1}, {(short unsigned int) item, (short) chunk} };
+
+		if (quota_enabled())
+			quota_acquire(quota_group(0), chunk, -1);
+		sync_op_many (take, 2, -1);
+		for (int i = 0; i < chunk; i++)
+		{
+			temp_job.job_id = next_job_id(temp_job.producer_id);
+			temp_job.duration = durations[done + i];
+			temp_job.seq = __sync_add_and_fetch(&next_seq, 1);
+			temp_job.produced_ns = now_ns();
+			temp_job.deadline_ns = deadline_after(temp_job.produced_ns);
+			journal_deposit(temp_job.seq, temp_job.duration);
+			deposit_item(temp_job);
+		}
+		bp_stats.deposited += chunk;
+		sync_op_many (release, 2, -1);
+		done += chunk;
+	}
+}
+
+/* Function used by consumers to run a job, whether fetched from the queue or released
+ * by the dependency scheduler, and to account for its completion */
+void execute_job(job *current, int consumer_id)
+{
+	//cancelled and expired jobs are retired without running; their slot is already free
+	int skip = cancel_check(current, now_ns());
+	if (skip != SKIP_NONE)
+	{
+		printf("Consumer(%d): Job seq %lu skipped (%s)\n", consumer_id, current->seq, (skip == SKIP_CANCELLED) ? "cancelled" : "expired");
+		journal_complete(current->seq);
+		if (completions != COMPLETIONS_OFF)
+			post_result(current, consumer_id, (skip == SKIP_CANCELLED) ? RESULT_CANCELLED : RESULT_EXPIRED);
+		dag_complete(current->seq);
+		return;
+	}
+
+	//account the time the job spent waiting, sampled by the autoscaler
+	long long waited = now_ns() - current->produced_ns;
+	if (waited > 0)
+	{
+		__sync_fetch_and_add(&wait_total_ns, waited);
+		__sync_fetch_and_add(&wait_samples, 1);
+	}
+	if (arrivals.process != ARRIVAL_CLOSED || replay_path != NULL)
+		histogram_record(&start_latency, waited);
+
+	//print consumption status and details
+	if (current->job_id > 0)
+		printf("Consumer(%d): Job ID %d executing sleep duration %d\n", consumer_id, current->job_id, current->duration);
+	else
+		printf("Consumer(%d): Job seq %lu executing sleep duration %d\n", consumer_id, current->seq, current->duration);
+	
+	//perform job consumption (sleep for duration)
+	long long execute_begin = wait_clock();
+	sleep(current->duration);
+	timeline_span("execute", execute_begin);
+
+	//print consumption status after job completion
+	if (current->job_id > 0)
+		printf("Consumer(%d): Job ID %d completed\n", consumer_id, current->job_id);
+	else
+		printf("Consumer(%d): Job seq %lu completed\n", consumer_id, current->seq);
+	journal_complete(current->seq);
+	if (completions != COMPLETIONS_OFF)
+		post_result(current, consumer_id, RESULT_COMPLETED);
+	if (arrivals.process != ARRIVAL_CLOSED || replay_path != NULL)
+		histogram_record(&completion_latency, now_ns() - current->produced_ns);
+	local_counters->consumed++;
+	perf_job_done();
+	dag_complete(current->seq);
+}
+
+/* Function used by a producer to deposit the jobs released on its own thread, which
+ * happens when it drops or evicts a job other jobs depend on */
+void deposit_released(int producer_id)
+{
+	job released;
+
+	while (dag_take_ready(&released))
+	{
+		take_space(released.producer_id, -1);
+		released.job_id = next_job_id(released.producer_id);
+		deposit_item(released);
+		bp_stats.deposited++;
+		sync_op_many (release_mutex_and_item, 2, -1);
+		printf("Producer(%d): Job ID %d duration %d released by its predecessors\n", producer_id, released.job_id, released.duration);
+	}
+}
+
+/* Function used to find the space semaphore guarding the slots of producer_id
+ * (0 for the journal and the ingestion front-end) */
+int space_of(int producer_id)
+{
+	return fair_queueing ? 3 + producer_id : space;
+}
+
+/* Function used to take one slot of producer_id's space together with mutex. With
+ * quotas the slot is claimed from the producer's group first, and time_delay only
+ * applies to that claim. */
+int take_space(int producer_id, int time_delay)
+{
+	const sem_op_entry take[] = { {(short unsigned int) space_of(producer_id), -1}, {(short unsigned int) mutex, -1} };
+
+	if (!quota_enabled())
+		return sync_op_many (take, 2, time_delay);
+	if (quota_acquire(quota_group(producer_id), 1, time_delay) != 0)
+		return -1;
+
+	//space is released before the quota and claimed after it, so only mutex can be busy
+	return sync_op_many (take, 2, -1);
+}
+
+/* Function used to give back a slot of producer_id's space together with mutex.
+ * Backends that apply the operations in order release space before mutex, so a
+ * producer holding mutex under the spill policy never misses a slot being freed. */
+void release_space(int producer_id)
+{
+	const sem_op_entry release[] = { {(short unsigned int) space_of(producer_id), 1}, {(short unsigned int) mutex, 1} };
+	sync_op_many (release, 2, -1);
+	if (quota_enabled())
+		quota_release(quota_group(producer_id), 1);
+}
+
+/* Function used to start a timed wait or a span, 0 when neither metrics nor the
+ * timeline are on so the clock is never read */
+long long wait_clock()
+{
+	return (metrics_on || timeline_on) ? now_ns() : 0;
+}
+
+/* Function used to compute the deadline of a job produced at start_ns */
+long long deadline_after(long long start_ns)
+{
+	return (job_deadline > 0) ? start_ns + job_deadline * 1000000000LL : 0;
+}
+
+/* Function used by consumers to hand a job's outcome back to its producer */
+void post_result(job *finished, int consumer_id, int status)
+{
+	job_result answer;
+
+	answer.seq = finished->seq;
+	answer.job_id = finished->job_id;
+	answer.consumer_id = consumer_id;
+	answer.status = status;
+	answer.produced_ns = finished->produced_ns;
+	answer.completed_ns = now_ns();
+	results_post(finished->producer_id, &answer);
+}
+
+/* Function used by a producer to collect the results of its jobs, up to limit of them
+ * (-1 for all that are ready). Returns the number collected. */
+int collect_results(int producer_id, int timeout_ms, long limit)
+{
+	job_result answer;
+	int collected = 0;
+
+	while ((limit < 0 || collected < limit) && results_wait(producer_id, &answer, timeout_ms) == 0)
+	{
+		collected++;
+		if (answer.status == RESULT_EVICTED)
+		{
+			printf("Producer(%d): Job ID %d was evicted before it ran\n", producer_id, answer.job_id);
+			continue;
+		}
+		if (answer.status != RESULT_COMPLETED)
+		{
+			printf("Producer(%d): Job seq %lu was skipped without running\n", producer_id, answer.seq);
+			continue;
+		}
+		histogram_record(&round_trip, answer.completed_ns - answer.produced_ns);
+		printf("Producer(%d): result for Job ID %d from Consumer(%d)\n", producer_id, answer.job_id, answer.consumer_id);
+	}
+	return collected;
+}
+
+/* Function used by a consumer to take one pending retirement request, if any */
+bool claim_retirement()
+{
+	int pending = retire_requests;
+
+	while (pending > 0)
+	{
+		if (__sync_bool_compare_and_swap(&retire_requests, pending, pending - 1))
+			return true;
+		pending = retire_requests;
+	}
+	return false;
+}
+
+/* Function used by the autoscaler to find a slot for a new consumer: the slot of a
+ * consumer that has left, once its thread is joined, or else one never used. The new
+ * consumer takes over the slot's id. Returns -1 if every slot is taken. */
+int free_consumer_slot()
+{
+	for (int slot = 0; slot < spawned_consumers; slot++)
+		if (__atomic_load_n(&consumer_exited[slot], __ATOMIC_ACQUIRE))
+		{
+			pthread_join (consumer_td[slot], NULL);
+			consumer_exited[slot] = false;
+			return slot;
+		}
+	return (spawned_consumers < max_consumers) ? spawned_consumers++ : -1;
+}
+
+/* Thread used to scale the consumer pool. Every scale_interval_ms it samples the
+ * queue occupancy and the mean wait of the jobs fetched since the last sample. A
+ * decision is only taken after scale_samples consecutive samples agree, and the
+ * streak restarts after each decision, so the pool does not flap. */
+void *autoscaler (void *arg)
+{
+	int up_streak = 0, down_streak = 0;
+	char reason[128];
+
+	while (!producers_done)
+	{
+		usleep(scale_interval_ms * 1000);
+
+		int occupancy = (100 * my_queue->count) / my_queue->array_size;
+		long long waited = __sync_lock_test_and_set(&wait_total_ns, 0);
+		long samples = __sync_lock_test_and_set(&wait_samples, 0);
+		long mean_wait_ms = samples ? (long) (waited / samples / 1000000) : 0;
+		int consumers = active_consumers - retire_requests;
+
+		//a consumer that went idle and left is replaced while producers are running
+		if (consumers < min_consumers)
+		{
+			snprintf(reason, sizeof(reason), "%d consumers below minimum %d", consumers, min_consumers);
+			up_streak = scale_samples;
+		}
+		else if (occupancy >= scale_up_occupancy)
+		{
+			snprintf(reason, sizeof(reason), "occupancy %d%% >= %d%%", occupancy, scale_up_occupancy);
+			up_streak++;
+			down_streak = 0;
+		}
+		else if (target_wait_ms > 0 && mean_wait_ms > target_wait_ms)
+		{
+			snprintf(reason, sizeof(reason), "mean wait %ld ms > target %d ms", mean_wait_ms, target_wait_ms);
+			up_streak++;
+			down_streak = 0;
+		}
+		else if (occupancy <= scale_down_occupancy && (target_wait_ms == 0 || mean_wait_ms <= target_wait_ms / 2))
+		{
+			snprintf(reason, sizeof(reason), "occupancy %d%% <= %d%%, mean wait %ld ms", occupancy, scale_down_occupancy, mean_wait_ms);
+			down_streak++;
+			up_streak = 0;
+		}
+		else
+			up_streak = down_streak = 0;
+
+		//a consumer that has just left may not have released its slot yet, then the next round retries
+		int consumer_id;
+		if (up_streak >= scale_samples && consumers < max_consumers && (consumer_id = free_consumer_slot()) >= 0)
+		{
+			__sync_fetch_and_add(&active_consumers, 1);
+			pthread_create (&consumer_td[consumer_id], NULL, consumer, (void *) (intptr_t) (consumer_id + 1));
+			printf("Autoscaler: spawned Consumer(%d), %d -> %d consumers (%s)\n", consumer_id + 1, consumers, consumers + 1, reason);
+			up_streak = 0;
+		}
+		else if (down_streak >= scale_samples && consumers > min_consumers)
+		{
+			__sync_fetch_and_add(&retire_requests, 1);
+			printf("Autoscaler: retiring a consumer, %d -> %d consumers (%s)\n", consumers, consumers - 1, reason);
+			down_streak = 0;
+		}
+	}
+
 	pthread_exit (0);
 }
 
@@ -213,29 +1285,467 @@ void setup_variables(char **argv)
 	number_of_consumers = check_arg(argv[4]);
 }
 
-/* Function used to initialize the circular buffer */
-void initializeQueue()
+/* Function used to parse the optional "name=value" arguments */
+int setup_options(int argc, char **argv)
 {
-	my_queue.head = 0;
-	my_queue.tail = 0;
-	my_queue.array_size = buffer_size;
-	my_queue.data = new job[buffer_size];
+	const char *value;
+
+	for (int i = 5; i < argc; i++)
+	{
+		if ((value = option_value(argv[i], "policy")) != NULL)
+		{
+			if (strcmp(value, "block") == 0)
+				policy = POLICY_BLOCK;
+			else if (strcmp(value, "drop") == 0)
+				policy = POLICY_DROP;
+			else if (strcmp(value, "drop-oldest") == 0)
+				policy = POLICY_DROP_OLDEST;
+			else if (strcmp(value, "spill") == 0)
+				policy = POLICY_SPILL;
+			else
+			{
+				cerr << "Unknown backpressure policy '" << value << "' (block, drop, drop-oldest, spill)" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "deadline")) != NULL)
+		{
+			if ((space_deadline = check_arg((char *) value)) <= 0)
+			{
+				cerr << "The deadline is supposed to be a positive number of seconds" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "spill_path")) != NULL)
+			spill_path = value;
+		else if ((value = option_value(argv[i], "ring_file")) != NULL)
+			ring_path = value;
+		else if ((value = option_value(argv[i], "sync")) != NULL)
+		{
+			if (sync_select(value) != 0)
+			{
+				cerr << "Unknown synchronization backend '" << value << "' (" << sync_backend_names() << ")" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "sem_key_path")) != NULL)
+			sem_key_path = value;
+		else if ((value = option_value(argv[i], "instance")) != NULL)
+		{
+			//ftok folds the instance into 8 bits, so larger numbers would share keys
+			if ((instance = check_arg((char *) value)) < 0 || instance > 254)
+			{
+				cerr << "instance is supposed to be a number from 0 to 254" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "sem_undo")) != NULL)
+			sem_undo = (strcmp(value, "off") != 0);
+		else if ((value = option_value(argv[i], "hugepages")) != NULL)
+			huge_pages = (strcmp(value, "on") == 0);
+		else if ((value = option_value(argv[i], "min_consumers")) != NULL)
+			min_consumers = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "max_consumers")) != NULL)
+			max_consumers = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "scale_interval_ms")) != NULL)
+			scale_interval_ms = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "scale_samples")) != NULL)
+			scale_samples = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "scale_up_occupancy")) != NULL)
+			scale_up_occupancy = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "scale_down_occupancy")) != NULL)
+			scale_down_occupancy = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "target_wait_ms")) != NULL)
+			target_wait_ms = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "arrival")) != NULL)
+		{
+			int process = arrival_process_from_name(value);
+			if (process < 0)
+			{
+				cerr << "Unknown arrival process '" << value << "' (closed, constant, poisson, bursty, diurnal, trace)" << endl;
+				return INVALID_OPTION;
+			}
+			arrivals.process = (arrival_process) process;
+		}
+		else if ((value = option_value(argv[i], "rate")) != NULL)
+		{
+			char *end;
+			arrivals.rate = strtod(value, &end);
+			if (end == value || *end != '\0' || arrivals.rate <= 0)
+			{
+				cerr << "rate is supposed to be a positive number of jobs per second" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "burst_on_ms")) != NULL)
+			arrivals.burst_on_ms = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "burst_off_ms")) != NULL)
+			arrivals.burst_off_ms = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "diurnal_period_s")) != NULL)
+			arrivals.diurnal_period_s = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "diurnal_amplitude")) != NULL)
+		{
+			arrivals.diurnal_amplitude = check_arg((char *) value);
+			if (arrivals.diurnal_amplitude < 0 || arrivals.diurnal_amplitude > 100)
+			{
+				cerr << "diurnal_amplitude is supposed to be a percentage from 0 to 100" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "arrival_trace")) != NULL)
+			arrivals.trace_path = value;
+		else if ((value = option_value(argv[i], "completions")) != NULL)
+		{
+			if (strcmp(value, "off") == 0)
+				completions = COMPLETIONS_OFF;
+			else if (strcmp(value, "async") == 0)
+				completions = COMPLETIONS_ASYNC;
+			else if (strcmp(value, "sync") == 0)
+				completions = COMPLETIONS_SYNC;
+			else
+			{
+				cerr << "Unknown completion mode '" << value << "' (off, async, sync)" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "fair")) != NULL)
+			fair_queueing = (strcmp(value, "on") == 0);
+		else if ((value = option_value(argv[i], "fair_quantum")) != NULL)
+			fair_quantum = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "metrics")) != NULL)
+			metrics_path = value;
+		else if ((value = option_value(argv[i], "metrics_interval_ms")) != NULL)
+		{
+			if ((metrics_interval_ms = check_arg((char *) value)) <= 0)
+			{
+				cerr << "metrics_interval_ms is supposed to be a positive number of milliseconds" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "perf")) != NULL)
+			perf_counters = (strcmp(value, "on") == 0);
+		else if ((value = option_value(argv[i], "lock_profile")) != NULL)
+			lock_profile = (strcmp(value, "on") == 0);
+		else if ((value = option_value(argv[i], "timeline")) != NULL)
+			timeline_path = value;
+		else if ((value = option_value(argv[i], "timeline_events")) != NULL)
+		{
+			if ((timeline_events = check_arg((char *) value)) <= 0)
+			{
+				cerr << "timeline_events is supposed to be a positive number of spans per thread" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "pipeline")) != NULL)
+			pipeline_stages = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "broadcast")) != NULL)
+			broadcast_groups = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "quota")) != NULL)
+		{
+			if (quota_init(check_arg(argv[1]), value) != 0)
+			{
+				cerr << "quota is supposed to list a positive weight per group, e.g. 2:1:1, with no more groups than buffer slots" << endl;
+				return INVALID_OPTION;
+			}
+			quota_weights = value;
+		}
+		else if ((value = option_value(argv[i], "job_deadline")) != NULL)
+			job_deadline = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "cancel")) != NULL)
+			cancel_percent = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "dag_deps")) != NULL)
+			dag_deps = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "dag_window")) != NULL)
+			dag_window = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "ingest")) != NULL)
+			ingest_address = value;
+		else if ((value = option_value(argv[i], "ingest_idle")) != NULL)
+			ingest_idle = check_arg((char *) value);
+		else if ((value = option_value(argv[i], "ingest_max_duration")) != NULL)
+		{
+			if ((ingest_max_duration = check_arg((char *) value)) <= 0)
+			{
+				cerr << "ingest_max_duration is supposed to be a positive number of seconds" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "record")) != NULL)
+			record_path = value;
+		else if ((value = option_value(argv[i], "replay")) != NULL)
+			replay_path = value;
+		else if ((value = option_value(argv[i], "replay_speed")) != NULL)
+		{
+			if ((replay_speed = strtod(value, NULL)) <= 0)
+			{
+				cerr << "replay_speed is supposed to be a positive factor" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "journal")) != NULL)
+			journal_path = value;
+		else if ((value = option_value(argv[i], "journal_sync_jobs")) != NULL)
+		{
+			if ((journal_sync_jobs = check_arg((char *) value)) < 0)
+			{
+				cerr << "journal_sync_jobs is supposed to be a number of jobs" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else if ((value = option_value(argv[i], "journal_sync_ms")) != NULL)
+		{
+			if ((journal_sync_ms = check_arg((char *) value)) < 0)
+			{
+				cerr << "journal_sync_ms is supposed to be a number of milliseconds" << endl;
+				return INVALID_OPTION;
+			}
+		}
+		else
+		{
+			cerr << "Unknown option '" << argv[i] << "'" << endl;
+			return INVALID_OPTION;
+		}
+	}
+
+	//in pipeline mode one thread per stage takes the place of the consumers, in broadcast
+	//mode every group gets as many members as there are consumers
+	if ((pipeline_stages > 0 || broadcast_groups > 0) && (min_consumers > 0 || max_consumers > 0))
+	{
+		cerr << "The pipeline and broadcast modes run a fixed set of threads and cannot be autoscaled" << endl;
+		return INVALID_OPTION;
+	}
+
+	//without explicit bounds the pool stays at the number of consumers given on the command line
+	int consumers = check_arg(argv[4]);
+	if (pipeline_stages > 0)
+		consumers = pipeline_stages;
+	else if (broadcast_groups > 0)
+		consumers *= broadcast_groups;
+	if (min_consumers == 0)
+		min_consumers = (max_consumers > 0 && max_consumers < consumers) ? max_consumers : consumers;
+	if (max_consumers == 0)
+		max_consumers = (consumers > min_consumers) ? consumers : min_consumers;
+	if (min_consumers < 0 || max_consumers < min_consumers || scale_interval_ms <= 0 || scale_samples <= 0
+		|| scale_up_occupancy < 0 || scale_down_occupancy < 0 || scale_down_occupancy >= scale_up_occupancy
+		|| target_wait_ms < 0)
+	{
+		cerr << "Invalid autoscaler settings: need min_consumers <= max_consumers and scale_down_occupancy < scale_up_occupancy" << endl;
+		return INVALID_OPTION;
+	}
+
+	if (job_deadline < 0 || cancel_percent < 0 || cancel_percent > 100)
+	{
+		cerr << "job_deadline is supposed to be a number of seconds and cancel a percentage" << endl;
+		return INVALID_OPTION;
+	}
+
+	if (dag_deps < 0 || dag_window <= 0)
+	{
+		cerr << "dag_deps is supposed to be a number of predecessors and dag_window a positive number of jobs" << endl;
+		return INVALID_OPTION;
+	}
+
+	//the dependency table is sized for the producers' jobs, ingested jobs would take its sequence numbers
+	if (dag_deps > 0 && ingest_address != NULL)
+	{
+		cerr << "Dependencies cannot be combined with ingestion" << endl;
+		return INVALID_OPTION;
+	}
+
+	if (ingest_address != NULL && (ingest_idle <= 0 || check_arg(argv[1]) <= 0))
+	{
+		cerr << "Ingestion needs a positive ingest_idle and buffer size" << endl;
+		return INVALID_OPTION;
+	}
+
+	if (arrival_setup() != NO_ERROR)
+		return INVALID_OPTION;
+
+	if (replay_path != NULL && arrivals.process != ARRIVAL_CLOSED)
+	{
+		cerr << "A replayed trace already defines the arrivals, drop the arrival option" << endl;
+		return INVALID_OPTION;
+	}
+	if (replay_path != NULL && trace_replay_open(replay_path, replay_speed, check_arg(argv[3])) != 0)
+	{
+		cerr << "Unable to load the trace '" << replay_path << "': " << strerror(errno) << endl;
+		return INVALID_OPTION;
+	}
+	if (record_path != NULL && trace_record_open(record_path) != 0)
+	{
+		cerr << "Unable to create the trace '" << record_path << "': " << strerror(errno) << endl;
+		return INVALID_OPTION;
+	}
+
+	//a ring file already persists every queued job, replaying a journal on top would duplicate them
+	if (ring_path != NULL && journal_path != NULL)
+	{
+		cerr << "The ring_file and journal options cannot be combined" << endl;
+		return INVALID_OPTION;
+	}
+
+	//sub-queues split the buffer between producers, who then only ever evict or spill their own jobs
+	if (fair_queueing && (ring_path != NULL || policy == POLICY_DROP_OLDEST || policy == POLICY_SPILL))
+	{
+		cerr << "Fair queueing works with the block and drop policies on the in-memory queue" << endl;
+		return INVALID_OPTION;
+	}
+
+	//stages and groups share the job array directly, outside of the semaphores and the features built on them
+	if (pipeline_stages < 0 || broadcast_groups < 0 || (pipeline_stages > 0 && broadcast_groups > 0))
+	{
+		cerr << "pipeline and broadcast are supposed to be numbers of stages and groups, and exclusive" << endl;
+		return INVALID_OPTION;
+	}
+	if ((pipeline_stages > 0 || broadcast_groups > 0) && (policy != POLICY_BLOCK || ring_path != NULL || journal_path != NULL
+		|| ingest_address != NULL || fair_queueing || quota_weights != NULL || dag_deps > 0))
+	{
+		cerr << "The pipeline and broadcast modes work with the block policy on the in-memory queue and" << endl;
+		cerr << "without the journal, ingestion, fair queueing, quotas or dependencies" << endl;
+		return INVALID_OPTION;
+	}
+
+	//quotas claim slots from the whole buffer, which neither evictions nor spills return
+	if (quota_weights != NULL && (fair_queueing || ring_path != NULL || policy == POLICY_DROP_OLDEST || policy == POLICY_SPILL))
+	{
+		cerr << "Quotas work with the block and drop policies on the in-memory queue, without fair queueing" << endl;
+		return INVALID_OPTION;
+	}
+	if (fair_queueing && check_arg(argv[1]) < check_arg(argv[3]) + 1)
+	{
+		cerr << "Fair queueing needs a buffer with more slots than producers" << endl;
+		return INVALID_OPTION;
+	}
+	if (fair_queueing && fair_quantum <= 0)
+	{
+		cerr << "fair_quantum is supposed to be a positive number of seconds" << endl;
+		return INVALID_OPTION;
+	}
+
+	//a ring file is backed by the page cache, which does not use huge pages
+	if (ring_path != NULL && huge_pages)
+	{
+		cerr << "The hugepages option only applies to the in-memory queue" << endl;
+		return INVALID_OPTION;
+	}
+
+	return NO_ERROR;
 }
 
-/* Function used to deposit a job in the buffer and incrementing the queue tail */
-void deposit_item(job new_job)
+/* Function used to obtain a slot in the buffer according to the backpressure policy.
+ * SPACE_ACQUIRED means the caller owns one unit of space; the other results mean
+ * the job has already been dealt with (or the producer has to stop). */
+int acquire_space(int producer_id, job new_job)
 {
-	my_queue.data[my_queue.tail] = new_job;
-	my_queue.tail = ((my_queue.tail + 1) % buffer_size);	
+	//fast path shared by all policies: space and mutex are both free right away
+	if (take_space(producer_id, 0) == 0)
+		return SPACE_ACQUIRED;
+
+	//the combined attempt also fails when only mutex is busy, which is not a full buffer
+	bool full = (sync_get_value(space_of(producer_id)) == 0 || (quota_enabled() && !quota_has_room(quota_group(producer_id))));
+	if (full)
+		local_counters->full_events++;
+
+	long long started;
+	switch (full ? policy : POLICY_BLOCK)
+	{
+		case POLICY_DROP:
+			__sync_fetch_and_add(&bp_stats.dropped, 1);
+			return SPACE_DROPPED;
+
+		case POLICY_DROP_OLDEST:
+			started = wait_clock();
+			lock_site_set(LOCK_DROP_OLDEST);
+			sync_wait (mutex);
+			lock_site_set(LOCK_DEPOSIT);
+			local_counters->blocked_mutex_ns += metrics_since(started);
+			timeline_span("wait-mutex", started);
+
+			//take over the oldest queued job if it has not been claimed by a consumer yet
+			if (sync_try_wait(item) == 0)
+			{
+				job evicted = fetch_item();
+				journal_complete(evicted.seq);
+				dag_complete(evicted.seq);
+				if (completions != COMPLETIONS_OFF)
+					post_result(&evicted, 0, RESULT_EVICTED);
+				journal_deposit(new_job.seq, new_job.duration);
+				new_job.job_id = next_job_id(new_job.producer_id);
+				deposit_item(new_job);
+				bp_stats.overwritten++;
+				bp_stats.deposited++;
+				sync_op_many(release_mutex_and_item, 2, -1);
+				return SPACE_OVERWRITTEN;
+			}
+			sync_signal (mutex);
+			break;
+
+		case POLICY_SPILL:
+			started = wait_clock();
+			lock_site_set(LOCK_SPILL);
+			sync_wait (mutex);
+			lock_site_set(LOCK_DEPOSIT);
+			local_counters->blocked_mutex_ns += metrics_since(started);
+			timeline_span("wait-mutex", started);
+
+			//consumers release space no later than mutex, so this check is exact
+			if (sync_try_wait(space) == 0)
+				return SPACE_ACQUIRED;
+			journal_deposit(new_job.seq, new_job.duration);
+			if (spill_push(&new_job) != 0)
+			{
+				sync_signal (mutex);
+				cerr << "Producer(" << producer_id << "): spill segment write failed, blocking instead" << endl;
+				break;
+			}
+			bp_stats.spilled++;
+			if (spill_count() > bp_stats.spill_peak)
+				bp_stats.spill_peak = spill_count();
+			sync_signal (mutex);
+			return SPACE_SPILLED;
+
+		case POLICY_BLOCK:
+			break;
+	}
+
+	//block until a slot and mutex are both available or the deadline expires
+	if (full)
+		__sync_fetch_and_add(&bp_stats.blocked, 1);
+	started = wait_clock();
+	int taken = take_space(producer_id, space_deadline);
+	timeline_span(full ? "wait-space" : "wait-mutex", started);
+	if (full)
+		local_counters->blocked_space_ns += metrics_since(started);
+	else
+		local_counters->blocked_mutex_ns += metrics_since(started);
+	if (taken != 0)
+	{
+		__sync_fetch_and_add(&bp_stats.timeouts, 1);
+		return SPACE_TIMEOUT;
+	}
+	return SPACE_ACQUIRED;
 }
 
-/* Function used to fetch a job from the buffer and incrementing the queue head */
-job fetch_item()
-{	
-	job myJob = my_queue.data[my_queue.head];
-	my_queue.head = ((my_queue.head + 1) % buffer_size);
-	
-	return myJob;
+/* Function used to report the counters of the selected backpressure policy */
+void print_backpressure_statistics()
+{
+	switch (policy)
+	{
+		case POLICY_BLOCK:
+			printf("Backpressure(block): deposited %ld blocked %ld timeouts %ld (deadline %d s)\n",
+				bp_stats.deposited, bp_stats.blocked, bp_stats.timeouts, space_deadline);
+			break;
+		case POLICY_DROP:
+			printf("Backpressure(drop): deposited %ld dropped %ld\n", bp_stats.deposited, bp_stats.dropped);
+			break;
+		case POLICY_DROP_OLDEST:
+			printf("Backpressure(drop-oldest): deposited %ld overwritten %ld blocked %ld timeouts %ld\n",
+				bp_stats.deposited, bp_stats.overwritten, bp_stats.blocked, bp_stats.timeouts);
+			break;
+		case POLICY_SPILL:
+			printf("Backpressure(spill): deposited %ld spilled %ld refilled %ld spill peak %ld still on disk %ld\n",
+				bp_stats.deposited, bp_stats.spilled, bp_stats.refilled, bp_stats.spill_peak, spill_count());
+			break;
+	}
 }
 
 /* Function used to produce a pseudo-random number between min and max. The seed is called in main */
@@ -245,23 +1755,63 @@ int produce(int min, int max)
 	return i;
 }
 
+/* Crash recovery: the queue (possibly a persisted ring file) is the source of truth.
+ * Its count is repaired first and item/space/mutex are then derived from it, which
+ * is what SEM_UNDO would otherwise have to guarantee on every operation. */
 int initialize_required_semaphores()
 {
-	if (sem_init (sem_id, item, 0))
+	int corrected = reconcile_queue();
+	if (corrected != 0)
+		printf("Recovery: queue count was off by %d, reconciled to %d jobs (head %d tail %d)\n",
+			corrected, my_queue->count, my_queue->head, my_queue->tail);
+	if (my_queue->count > 0)
+		printf("Recovery: item %d space %d mutex 1\n", my_queue->count, buffer_size - my_queue->count);
+
+	//new jobs are numbered after the restored ones, so sequence numbers stay unique
+	unsigned long restored_seq = adopt_restored_jobs(now_ns());
+	if (restored_seq > next_seq)
+		next_seq = restored_seq;
+
+	if (sync_init (item, my_queue->count))
 	{
 		cerr << "Error found in semaphore 'item' initialization due to: " << endl;
 		return errno;
 	} 
-	else if (sem_init (sem_id, space, buffer_size))
+	else if (sync_init (space, buffer_size - my_queue->count))
 	{
 		cerr << "Error found in semaphore 'space' initialization due to: " << endl;
 		return errno;
 	}
-	else if (sem_init (sem_id, mutex, 1))
+	else if (sync_init (mutex, 1))
 	{
 		cerr << "Error found in semaphore 'mutex' initialization due to: " << endl;
 		return errno;
 	}
 
+	//fair queueing splits the buffer evenly between the sub-queues that can receive jobs
+	if (fair_queueing)
+	{
+		int slots[number_of_producers + 1];
+		bool shared = (journal_path != NULL || ingest_address != NULL);
+		int parts = number_of_producers + (shared ? 1 : 0);
+		int extra = buffer_size % parts;
+
+		for (int q = 0; q <= number_of_producers; q++)
+		{
+			slots[q] = (q == 0 && !shared) ? 0 : buffer_size / parts;
+			if (slots[q] > 0 && extra > 0)
+			{
+				slots[q]++;
+				extra--;
+			}
+			if (sync_init (3 + q, slots[q]))
+			{
+				cerr << "Error found in semaphore 'space' of sub-queue " << q << " initialization due to: " << endl;
+				return errno;
+			}
+		}
+		fair_init(number_of_producers + 1, slots, fair_quantum);
+	}
+
 	return NO_ERROR;
 }
@@ -0,0 +1,172 @@
+/******************************************************************
+ * The metrics reporter:
+ * metrics_start - Allocates the counter blocks and starts the reporter
+ * metrics_register - Gives the calling thread its own counter block
+ * metrics_stop - Writes a last snapshot and stops the reporter
+ *
+ * Counter blocks are written by their owner only and read without
+ * locks by the reporter; an aligned 64-bit load never tears, so a
+ * snapshot is at worst one increment behind. The snapshot is written
+ * to a temporary file and renamed over the previous one, so readers
+ * never see a partial file.
+ ******************************************************************/
+
+#include "metrics.h"
+#include "queue.h"
+#include <limits.h>
+
+/* Threads that are not tracked count into a block of their own, so the hot path
+ * never shares a cache line; only threads that never register share the static one */
+static thread_counters discarded;
+static __thread thread_counters own_discarded;
+__thread thread_counters *local_counters = &discarded;
+bool metrics_on = false;
+
+static thread_counters *blocks = NULL;
+static int block_count = 0, block_capacity = 0;
+static const char *snapshot_path = NULL;
+static int snapshot_interval_ms = 1000;
+static long snapshots = 0;
+
+static pthread_t reporter;
+static pthread_mutex_t reporter_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reporter_cond = PTHREAD_COND_INITIALIZER;
+static bool reporter_stop = false;
+
+void metrics_register (const char *role, int id)
+{
+	local_counters = &own_discarded;
+	if (!metrics_on)
+		return;
+
+	//a consumer started in the slot of one that left keeps adding to the same block
+	int count = (block_count < block_capacity) ? block_count : block_capacity;
+	for (int i = 0; i < count; i++)
+		if (blocks[i].role != NULL && blocks[i].id == id && strcmp(blocks[i].role, role) == 0)
+		{
+			__atomic_store_n(&local_counters, &blocks[i], __ATOMIC_RELEASE);
+			return;
+		}
+
+	int index = __sync_fetch_and_add(&block_count, 1);
+	if (index >= block_capacity)
+		return;
+	blocks[index].role = role;
+	blocks[index].id = id;
+	__atomic_store_n(&local_counters, &blocks[index], __ATOMIC_RELEASE);
+}
+
+/* Function used to write one metric family, with a series per registered thread */
+static void write_family (FILE *out, const char *name, const char *help, long long thread_counters::*field, double scale)
+{
+	int count = (block_count < block_capacity) ? block_count : block_capacity;
+
+	fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+	for (int i = 0; i < count; i++)
+		if (blocks[i].role != NULL)
+			fprintf(out, "%s{role=\"%s\",thread=\"%d\"} %.9g\n", name, blocks[i].role, blocks[i].id,
+				__atomic_load_n(&(blocks[i].*field), __ATOMIC_RELAXED) * scale);
+}
+
+static void write_family (FILE *out, const char *name, const char *help, long thread_counters::*field)
+{
+	int count = (block_count < block_capacity) ? block_count : block_capacity;
+
+	fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+	for (int i = 0; i < count; i++)
+		if (blocks[i].role != NULL)
+			fprintf(out, "%s{role=\"%s\",thread=\"%d\"} %ld\n", name, blocks[i].role, blocks[i].id,
+				__atomic_load_n(&(blocks[i].*field), __ATOMIC_RELAXED));
+}
+
+/* Function used to write a snapshot next to the target and rename it into place */
+static int write_snapshot ()
+{
+	char temporary[PATH_MAX];
+	snprintf(temporary, sizeof(temporary), "%s.tmp", snapshot_path);
+
+	FILE *out = fopen(temporary, "w");
+	if (out == NULL)
+		return -1;
+
+	write_family(out, "pcq_jobs_produced_total", "Jobs accepted from producers.", &thread_counters::produced);
+	write_family(out, "pcq_jobs_consumed_total", "Jobs run by consumers.", &thread_counters::consumed);
+	write_family(out, "pcq_blocked_space_seconds_total", "Time spent waiting for buffer space.", &thread_counters::blocked_space_ns, 1e-9);
+	write_family(out, "pcq_blocked_item_seconds_total", "Time spent waiting for a job.", &thread_counters::blocked_item_ns, 1e-9);
+	write_family(out, "pcq_blocked_mutex_seconds_total", "Time spent waiting for the queue mutex.", &thread_counters::blocked_mutex_ns, 1e-9);
+	write_family(out, "pcq_timeouts_total", "Waits that gave up after their deadline.", &thread_counters::timeouts);
+	write_family(out, "pcq_queue_full_total", "Times a producer found the buffer full.", &thread_counters::full_events);
+	write_family(out, "pcq_queue_empty_total", "Times a consumer found the buffer empty.", &thread_counters::empty_events);
+
+	fprintf(out, "# HELP pcq_queue_depth Jobs currently in the buffer.\n# TYPE pcq_queue_depth gauge\npcq_queue_depth %d\n",
+		__atomic_load_n(&my_queue->count, __ATOMIC_RELAXED));
+	fprintf(out, "# HELP pcq_queue_capacity Slots in the buffer.\n# TYPE pcq_queue_capacity gauge\npcq_queue_capacity %d\n",
+		my_queue->array_size);
+	fprintf(out, "# HELP pcq_threads_dropped Threads that registered after every counter block was taken.\n"
+		"# TYPE pcq_threads_dropped gauge\npcq_threads_dropped %d\n",
+		(block_count > block_capacity) ? block_count - block_capacity : 0);
+
+	if (fclose(out) != 0 || rename(temporary, snapshot_path) != 0)
+	{
+		unlink(temporary);
+		return -1;
+	}
+	snapshots++;
+	return 0;
+}
+
+static void *metrics_reporter (void *arg)
+{
+	struct timespec until;
+
+	pthread_mutex_lock(&reporter_lock);
+	while (!reporter_stop)
+	{
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += snapshot_interval_ms / 1000;
+		until.tv_nsec += (snapshot_interval_ms % 1000) * 1000000L;
+		if (until.tv_nsec >= 1000000000L)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&reporter_cond, &reporter_lock, &until);
+
+		pthread_mutex_unlock(&reporter_lock);
+		if (write_snapshot() != 0)
+			cerr << "Metrics: unable to write '" << snapshot_path << "': " << strerror(errno) << endl;
+		pthread_mutex_lock(&reporter_lock);
+	}
+	pthread_mutex_unlock(&reporter_lock);
+	return NULL;
+}
+
+int metrics_start (const char *path, int interval_ms, int max_threads)
+{
+	blocks = new thread_counters[max_threads]();
+	block_capacity = max_threads;
+	snapshot_path = path;
+	snapshot_interval_ms = interval_ms;
+	metrics_on = true;
+
+	//fail early on a path that cannot be written
+	if (write_snapshot() != 0)
+		return -1;
+	return pthread_create(&reporter, NULL, metrics_reporter, NULL);
+}
+
+void metrics_stop ()
+{
+	if (!metrics_on)
+		return;
+
+	pthread_mutex_lock(&reporter_lock);
+	reporter_stop = true;
+	pthread_cond_signal(&reporter_cond);
+	pthread_mutex_unlock(&reporter_lock);
+	pthread_join(reporter, NULL);
+
+	//the file is left with the final counts
+	write_snapshot();
+	printf("Metrics: %ld snapshots written to %s\n", snapshots, snapshot_path);
+}
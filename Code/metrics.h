@@ -0,0 +1,44 @@
+/******************************************************************
+ * Header file for live metrics. Every producer and consumer thread
+ * owns a cache-line-padded block of counters that only it writes,
+ * so counting costs a plain increment. A reporter thread adds them
+ * up every interval and atomically replaces a snapshot file in the
+ * Prometheus text exposition format, ready to be scraped.
+ ******************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "helper.h"
+
+/* Counters of one thread. Times are in nanoseconds. */
+struct thread_counters
+{
+	const char *role;
+	int id;
+	long produced;
+	long consumed;
+	long long blocked_space_ns;
+	long long blocked_item_ns;
+	long long blocked_mutex_ns;
+	long timeouts;
+	long full_events;	//a producer found no space left
+	long empty_events;	//a consumer found no job to take
+} __attribute__((aligned(64)));
+
+/* Counters of the calling thread; with metrics off each registered thread counts into
+ * its own discarded block */
+extern __thread thread_counters *local_counters;
+extern bool metrics_on;
+
+int metrics_start (const char *path, int interval_ms, int max_threads);
+void metrics_register (const char *role, int id);
+void metrics_stop ();
+
+/* Time elapsed since wait_clock() returned started (0 when nothing is timed) */
+static inline long long metrics_since (long long started)
+{
+	return started ? now_ns() - started : 0;
+}
+
+#endif
@@ -0,0 +1,204 @@
+/******************************************************************
+ * Per-thread hardware counters:
+ * perf_init - Allocates a record for every thread that may be profiled
+ * perf_thread_start - Opens the calling thread's counters, disabled
+ * perf_section_begin - Enables them around a queue operation
+ * perf_section_end - Disables them again once the operation is done
+ * perf_job_done - Counts a job handled by the calling thread
+ * perf_thread_stop - Reads and closes the calling thread's counters
+ *
+ * The counters only run inside the deposit and fetch sections, so the
+ * sleeps that stand in for work and the console output are left out
+ * and the per-job figures describe the queue itself.
+ *
+ * Hardware counters only count user space, which perf_event_paranoid
+ * 2 (the usual default) still allows. A counter the kernel or the CPU does
+ * not support (containers, virtual machines) is reported as
+ * unavailable instead of failing the run.
+ ******************************************************************/
+
+#include "perfcount.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#define PERF_COUNTERS	5
+
+/* The counters opened for every thread */
+static const struct
+{
+	const char *name;
+	unsigned int type;
+	unsigned long long config;
+} counter_spec[PERF_COUNTERS] =
+{
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "L1d misses", PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ "LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ "context switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+/* Counters of one thread, read when it stops */
+struct perf_record
+{
+	const char *role;
+	int id;
+	long jobs;
+	bool counting;		//inside a section
+	int fds[PERF_COUNTERS];
+	long long values[PERF_COUNTERS];	//-1 when the counter could not be opened
+};
+
+bool perf_on = false;
+
+static perf_record *records = NULL;
+static int record_count = 0, record_capacity = 0;
+static int open_errors[PERF_COUNTERS];
+static __thread perf_record *local_perf = NULL;
+
+void perf_init (int max_threads)
+{
+	records = new perf_record[max_threads]();
+	record_capacity = max_threads;
+	perf_on = true;
+}
+
+static int perf_event_open (struct perf_event_attr *attr)
+{
+	return syscall(SYS_perf_event_open, attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+void perf_thread_start (const char *role, int id)
+{
+	if (!perf_on)
+		return;
+
+	//a consumer started in the slot of one that left adds to the same record
+	perf_record *own = NULL;
+	int count = (record_count < record_capacity) ? record_count : record_capacity;
+	for (int i = 0; i < count && own == NULL; i++)
+		if (records[i].role != NULL && records[i].id == id && strcmp(records[i].role, role) == 0)
+			own = &records[i];
+
+	if (own == NULL)
+	{
+		int index = __sync_fetch_and_add(&record_count, 1);
+		if (index >= record_capacity)
+			return;
+
+		own = &records[index];
+		own->role = role;
+		own->id = id;
+		for (int c = 0; c < PERF_COUNTERS; c++)
+			own->values[c] = -1;
+	}
+
+	for (int c = 0; c < PERF_COUNTERS; c++)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counter_spec[c].type;
+		attr.config = counter_spec[c].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.disabled = 1;
+
+		//pid 0 and cpu -1 follow this thread on every CPU; the counter starts disabled.
+		//Context switches happen in the kernel, so they are tried with it included first.
+		own->fds[c] = -1;
+		if (attr.type == PERF_TYPE_SOFTWARE)
+		{
+			attr.exclude_kernel = 0;
+			own->fds[c] = perf_event_open(&attr);
+			attr.exclude_kernel = 1;
+		}
+		if (own->fds[c] < 0)
+			own->fds[c] = perf_event_open(&attr);
+		if (own->fds[c] < 0)
+			open_errors[c] = errno;
+	}
+	own->counting = false;
+	local_perf = own;
+}
+
+/* Function used to switch the calling thread's counters on or off */
+static void perf_switch (perf_record *own, bool on)
+{
+	for (int c = 0; c < PERF_COUNTERS; c++)
+		if (own->fds[c] >= 0)
+			ioctl(own->fds[c], on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+	own->counting = on;
+}
+
+void perf_section_begin ()
+{
+	if (local_perf != NULL && !local_perf->counting)
+		perf_switch(local_perf, true);
+}
+
+void perf_section_end ()
+{
+	if (local_perf != NULL && local_perf->counting)
+		perf_switch(local_perf, false);
+}
+
+void perf_job_done ()
+{
+	if (local_perf != NULL)
+		local_perf->jobs++;
+}
+
+void perf_thread_stop ()
+{
+	perf_record *own = local_perf;
+	if (own == NULL)
+		return;
+
+	for (int c = 0; c < PERF_COUNTERS; c++)
+	{
+		long long value;
+		if (own->fds[c] < 0)
+			continue;
+		if (read(own->fds[c], &value, sizeof(value)) == sizeof(value))
+			own->values[c] = (own->values[c] < 0) ? value : own->values[c] + value;
+		close(own->fds[c]);
+	}
+	local_perf = NULL;
+}
+
+/* Function used to print a counter total and its value per job, or why it is missing */
+static void print_counter (int c, long long value, long jobs)
+{
+	if (value < 0)
+		printf(" %s n/a", counter_spec[c].name);
+	else if (jobs > 0)
+		printf(" %s %lld (%.1f/job)", counter_spec[c].name, value, (double) value / jobs);
+	else
+		printf(" %s %lld", counter_spec[c].name, value);
+}
+
+void print_perf_statistics ()
+{
+	int count = (record_count < record_capacity) ? record_count : record_capacity;
+
+	printf("Performance counters around deposits and fetches (hardware ones count user space only):\n");
+	for (int c = 0; c < PERF_COUNTERS; c++)
+		if (open_errors[c] != 0)
+			printf("  %s unavailable: %s\n", counter_spec[c].name, strerror(open_errors[c]));
+
+	for (int t = 0; t < count; t++)
+	{
+		perf_record *record = &records[t];
+		printf("  %s %d: jobs %ld", record->role, record->id, record->jobs);
+		for (int c = 0; c < PERF_COUNTERS; c++)
+			print_counter(c, record->values[c], record->jobs);
+		if (record->values[0] > 0 && record->values[1] >= 0)
+			printf(" IPC %.2f", (double) record->values[1] / record->values[0]);
+		printf("\n");
+	}
+	delete[] records;
+	records = NULL;
+}
@@ -0,0 +1,25 @@
+/******************************************************************
+ * Header file for hardware performance counters. With profiling on,
+ * every producer and consumer thread opens its own counters with
+ * perf_event_open when it starts (cycles, instructions, L1 data and
+ * last-level cache misses, context switches), runs them only while
+ * it deposits or fetches a job, reads them when it exits, and the
+ * totals are reported per thread and per job.
+ ******************************************************************/
+
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include "helper.h"
+
+extern bool perf_on;
+
+void perf_init (int max_threads);
+void perf_thread_start (const char *role, int id);
+void perf_section_begin ();
+void perf_section_end ();
+void perf_job_done ();
+void perf_thread_stop ();
+void print_perf_statistics ();
+
+#endif
@@ -0,0 +1,285 @@
+/******************************************************************
+ * The shared ring (a Disruptor-style sequencer):
+ * pipeline_init - Chains readers into stages
+ * broadcast_init - Sets up consumer groups that all read every job
+ * pipeline_publish - Claims the next sequence, fills its slot and publishes it
+ * pipeline_next - Waits until a reader's next sequence is ready and returns its slot
+ * pipeline_done - Advances a reader's sequence past the slot it processed
+ * pipeline_close - Lets the readers finish once the last job has gone through
+ *
+ * Sequences grow forever and map to slot seq % array_size. Producers
+ * claim sequences with a compare-and-swap and publish them by storing
+ * the sequence into the slot's published marker, so a reader can tell
+ * a filled slot from one still being written. Every reader is a
+ * single thread owning its sequence. A reader reads every stride-th
+ * sequence starting at its offset (members of a broadcast group split
+ * the sequences that way), and its barrier is either the producers'
+ * markers or the sequence of the reader upstream of it. Waiting spins
+ * briefly, then sleeps on a condition variable that is only signalled
+ * when some thread is actually asleep.
+ ******************************************************************/
+
+#include "pipeline.h"
+
+#define SPIN_LIMIT	1000
+
+/* State of one reader, on its own cache line so readers do not slow each other down */
+struct ring_reader
+{
+	long cursor;		//last sequence processed
+	int stride;
+	int upstream;		//reader this one follows, -1 to follow the producers
+	int group;
+	long processed, skipped, sleeps;
+	long long busy_ns, started_ns;
+} __attribute__((aligned(64)));
+
+/* A sequence on its own cache line */
+struct padded_sequence
+{
+	long value;
+	char pad[64 - sizeof(long)];
+} __attribute__((aligned(64)));
+
+static bool broadcast = false;
+static int reader_count = 0, group_count = 0, ring_size = 0;
+static padded_sequence claim;			//next sequence handed to a producer
+static ring_reader *readers = NULL;
+static long *published = NULL;			//sequence last published into each slot
+static bool *skip_flags = NULL;			//pipeline: set by the first stage for jobs the others pass over
+static int *remaining = NULL;			//broadcast: groups still to see the job in each slot
+static long producer_sleeps = 0;
+static bool closed = false;
+
+static pthread_mutex_t pipeline_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pipeline_cond = PTHREAD_COND_INITIALIZER;
+static int sleepers = 0;
+
+/* Function used to allocate the readers and the per-slot state */
+static void ring_setup (int count)
+{
+	reader_count = count;
+	ring_size = my_queue->array_size;
+	claim.value = 0;
+	readers = new ring_reader[count]();
+	published = new long[ring_size];
+	for (int i = 0; i < ring_size; i++)
+		published[i] = -1;
+	skip_flags = new bool[ring_size]();
+	remaining = new int[ring_size]();
+}
+
+int pipeline_init (int stages)
+{
+	ring_setup(stages);
+	group_count = 1;
+	for (int s = 0; s < stages; s++)
+	{
+		readers[s].cursor = -1;
+		readers[s].stride = 1;
+		readers[s].upstream = s - 1;
+	}
+	return 0;
+}
+
+int broadcast_init (int groups, int members)
+{
+	ring_setup(groups * members);
+	broadcast = true;
+	group_count = groups;
+	for (int r = 0; r < groups * members; r++)
+	{
+		//member m starts right before sequence m, so its first job is m
+		readers[r].cursor = r % members - members;
+		readers[r].stride = members;
+		readers[r].upstream = -1;
+		readers[r].group = r / members;
+	}
+	return 0;
+}
+
+bool pipeline_enabled ()
+{
+	return readers != NULL;
+}
+
+/* Function used after a sequence moved, waking the threads asleep in wait_until */
+static void wake_sleepers ()
+{
+	//the load below must not be done ahead of the caller's release store, or a reader
+	//that has just counted itself and found nothing ready would miss this wake-up
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST) == 0)
+		return;
+	pthread_mutex_lock(&pipeline_lock);
+	pthread_cond_broadcast(&pipeline_cond);
+	pthread_mutex_unlock(&pipeline_lock);
+}
+
+/* Function used to wait until ready(seq, reader) holds. Returns false if deadline_ns
+ * (0 for none) passes first. Sleeps are counted in *sleeps. */
+static bool wait_until (bool (*ready) (long, int), long seq, int reader, long long deadline_ns, long *sleeps)
+{
+	for (int spin = 0; spin < SPIN_LIMIT; spin++)
+		if (ready(seq, reader))
+			return true;
+
+	pthread_mutex_lock(&pipeline_lock);
+	__atomic_add_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+	while (!ready(seq, reader))
+	{
+		(*sleeps)++;
+		if (deadline_ns == 0)
+			pthread_cond_wait(&pipeline_cond, &pipeline_lock);
+		else
+		{
+			long long left = deadline_ns - now_ns();
+			if (left <= 0)
+				break;
+
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_sec += left / 1000000000LL;
+			until.tv_nsec += left % 1000000000LL;
+			if (until.tv_nsec >= 1000000000L)
+			{
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&pipeline_cond, &pipeline_lock, &until);
+		}
+	}
+	__atomic_sub_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+	bool done = ready(seq, reader);
+	pthread_mutex_unlock(&pipeline_lock);
+	return done;
+}
+
+/* The slot of seq is free once every reader is past the sequence that used it before.
+ * A reader waiting for cursor + stride is past every sequence before that one. */
+static bool slot_free (long seq, int reader)
+{
+	for (int r = 0; r < reader_count; r++)
+		if (seq - ring_size > __atomic_load_n(&readers[r].cursor, __ATOMIC_ACQUIRE) + readers[r].stride - 1)
+			return false;
+	return true;
+}
+
+int pipeline_publish (job *new_job, int time_delay)
+{
+	long long deadline_ns = (time_delay < 0) ? 0 : now_ns() + time_delay * 1000000000LL;
+	long seq, sleeps = 0;
+
+	//a sequence is only claimed once its slot is free, so a producer that times out
+	//leaves no hole behind for the readers to wait on
+	for (;;)
+	{
+		seq = __atomic_load_n(&claim.value, __ATOMIC_ACQUIRE);
+		if (!slot_free(seq, 0) && !wait_until(slot_free, seq, 0, deadline_ns, &sleeps))
+		{
+			__sync_fetch_and_add(&producer_sleeps, sleeps);
+			return -1;
+		}
+		if (__sync_bool_compare_and_swap(&claim.value, seq, seq + 1))
+			break;
+	}
+	__sync_fetch_and_add(&producer_sleeps, sleeps);
+
+	int slot = seq % ring_size;
+	new_job->job_id = slot + 1;
+	my_queue->data[slot] = *new_job;
+	skip_flags[slot] = false;
+	remaining[slot] = group_count;
+	__atomic_store_n(&published[slot], seq, __ATOMIC_RELEASE);
+	wake_sleepers();
+	return 0;
+}
+
+/* Barrier of a reader: its upstream reader, or the producer of seq, is done with it.
+ * Once closed, sequences nobody claimed are ready too, which ends the reader. */
+static bool seq_ready (long seq, int reader)
+{
+	int upstream = readers[reader].upstream;
+
+	if (__atomic_load_n(&closed, __ATOMIC_ACQUIRE) && seq >= __atomic_load_n(&claim.value, __ATOMIC_ACQUIRE))
+		return true;
+	if (upstream < 0)
+		return __atomic_load_n(&published[seq % ring_size], __ATOMIC_ACQUIRE) == seq;
+	return __atomic_load_n(&readers[upstream].cursor, __ATOMIC_ACQUIRE) >= seq;
+}
+
+bool pipeline_next (int reader, job **slot, bool *skipped)
+{
+	ring_reader *own = &readers[reader];
+	long seq = own->cursor + own->stride;
+
+	wait_until(seq_ready, seq, reader, 0, &own->sleeps);
+
+	//closed and every claimed sequence has gone through
+	if (seq >= __atomic_load_n(&claim.value, __ATOMIC_ACQUIRE))
+		return false;
+
+	*slot = &my_queue->data[seq % ring_size];
+	*skipped = skip_flags[seq % ring_size];
+	own->started_ns = now_ns();
+	return true;
+}
+
+bool pipeline_done (int reader, bool skipped)
+{
+	ring_reader *own = &readers[reader];
+	long seq = own->cursor + own->stride;
+	bool last;
+
+	if (skipped)
+	{
+		if (!broadcast)
+			skip_flags[seq % ring_size] = true;
+		own->skipped++;
+	}
+	else
+	{
+		own->processed++;
+		own->busy_ns += now_ns() - own->started_ns;
+	}
+
+	//the job is finished once the last stage, or the last of the groups, is done with it
+	if (broadcast)
+		last = (__sync_sub_and_fetch(&remaining[seq % ring_size], 1) == 0);
+	else
+		last = (reader == reader_count - 1);
+
+	__atomic_store_n(&own->cursor, seq, __ATOMIC_RELEASE);
+	wake_sleepers();
+	return last;
+}
+
+void pipeline_close ()
+{
+	__atomic_store_n(&closed, true, __ATOMIC_RELEASE);
+	wake_sleepers();
+}
+
+void print_pipeline_statistics ()
+{
+	printf("%s: %d readers over %d slots, %ld jobs published, producers slept %ld times on a full ring\n",
+		broadcast ? "Broadcast" : "Pipeline", reader_count, ring_size, claim.value, producer_sleeps);
+	for (int r = 0; r < reader_count; r++)
+	{
+		if (broadcast)
+			printf("  Group %d member %d:", readers[r].group + 1, r % readers[r].stride + 1);
+		else
+			printf("  Stage %d:", r + 1);
+		printf(" processed %ld skipped %ld busy %.2f s sleeps %ld\n",
+			readers[r].processed, readers[r].skipped, readers[r].busy_ns / 1e9, readers[r].sleeps);
+	}
+}
+
+void pipeline_destroy ()
+{
+	delete[] readers;
+	delete[] published;
+	delete[] skip_flags;
+	delete[] remaining;
+	readers = NULL;
+}
@@ -0,0 +1,28 @@
+/******************************************************************
+ * Header file for the shared-ring modes. Jobs are published into
+ * the circular_queue's job array and read in place by readers, each
+ * tracking its own sequence, instead of being fetched by a single
+ * consumer:
+ *  - pipeline: readers are stages (for instance parse, enrich,
+ *    write) and stage k only reads what stage k-1 has finished;
+ *  - broadcast: every consumer group reads every job, its members
+ *    splitting the sequences between them.
+ * Producers are gated by the slowest reader, which frees the slots.
+ ******************************************************************/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "queue.h"
+
+int pipeline_init (int stages);
+int broadcast_init (int groups, int members);
+bool pipeline_enabled ();
+int pipeline_publish (job *new_job, int time_delay);
+bool pipeline_next (int reader, job **slot, bool *skipped);
+bool pipeline_done (int reader, bool skipped);
+void pipeline_close ();
+void print_pipeline_statistics ();
+void pipeline_destroy ();
+
+#endif
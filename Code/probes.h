@@ -0,0 +1,78 @@
+/******************************************************************
+ * Header file for the static probes (USDT). Each probe is a single
+ * nop plus an entry in the .note.stapsdt section, in the layout of
+ * systemtap's <sys/sdt.h>, so bpftrace, perf probe, systemtap and
+ * other uprobe-based tools can list and attach to them without a
+ * rebuild ("usdt:./main:pcq:deposit" for instance). A tool attaching
+ * to a probe that has a semaphore increments it, which lets the code
+ * skip work (like reading the clock) while nobody listens.
+ *
+ * Arguments are passed as 8-byte signed values. Building with
+ * -DPCQ_NO_PROBES, or for an architecture other than x86-64 and
+ * AArch64, compiles the probes out.
+ ******************************************************************/
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(PCQ_NO_PROBES) && (defined(__x86_64__) || defined(__aarch64__))
+
+/* Note describing the probe at label 990, followed by the shared base symbol tools
+ * use to relocate the addresses of a prelinked or position-independent binary */
+#define _PCQ_PROBE_NOTE(name, semaphore, arguments) \
+	"990:	nop\n" \
+	".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+	".balign 4\n" \
+	".4byte 992f-991f, 994f-993f, 3\n" \
+	"991:	.asciz \"stapsdt\"\n" \
+	"992:	.balign 4\n" \
+	"993:	.8byte 990b\n" \
+	".8byte _.stapsdt.base\n" \
+	".8byte " semaphore "\n" \
+	".asciz \"pcq\"\n" \
+	".asciz \"" #name "\"\n" \
+	".asciz \"" arguments "\"\n" \
+	"994:	.balign 4\n" \
+	".popsection\n" \
+	".ifndef _.stapsdt.base\n" \
+	".pushsection .stapsdt.base, \"aG\", \"progbits\", .stapsdt.base, comdat\n" \
+	".weak _.stapsdt.base\n" \
+	".hidden _.stapsdt.base\n" \
+	"_.stapsdt.base: .space 1\n" \
+	".size _.stapsdt.base, 1\n" \
+	".popsection\n" \
+	".endif\n"
+
+#define _PCQ_ARG(value) "nor" ((long long) (value))
+
+/* Counter a tool increments while it is attached to the probe */
+#define PCQ_PROBE_SEMAPHORE(name) \
+	unsigned short pcq_##name##_semaphore __attribute__((section(".probes"), used)) = 0
+#define PCQ_PROBE_ENABLED(name) \
+	__builtin_expect(*(volatile unsigned short *) &pcq_##name##_semaphore != 0, 0)
+#define _PCQ_SEMAPHORE(name) "pcq_" #name "_semaphore"
+
+#define PCQ_PROBE2(name, a1, a2) \
+	__asm__ __volatile__ (_PCQ_PROBE_NOTE(name, "0", "-8@%0 -8@%1") :: _PCQ_ARG(a1), _PCQ_ARG(a2))
+#define PCQ_PROBE3(name, a1, a2, a3) \
+	__asm__ __volatile__ (_PCQ_PROBE_NOTE(name, "0", "-8@%0 -8@%1 -8@%2") :: _PCQ_ARG(a1), _PCQ_ARG(a2), _PCQ_ARG(a3))
+#define PCQ_PROBE2_SEM(name, a1, a2) \
+	__asm__ __volatile__ (_PCQ_PROBE_NOTE(name, _PCQ_SEMAPHORE(name), "-8@%0 -8@%1") :: _PCQ_ARG(a1), _PCQ_ARG(a2))
+#define PCQ_PROBE4_SEM(name, a1, a2, a3, a4) \
+	__asm__ __volatile__ (_PCQ_PROBE_NOTE(name, _PCQ_SEMAPHORE(name), "-8@%0 -8@%1 -8@%2 -8@%3") \
+		:: _PCQ_ARG(a1), _PCQ_ARG(a2), _PCQ_ARG(a3), _PCQ_ARG(a4))
+
+#else
+
+#define PCQ_PROBE_SEMAPHORE(name)	static const unsigned short pcq_##name##_semaphore __attribute__((unused)) = 0
+#define PCQ_PROBE_ENABLED(name)		false
+/* The arguments are still named, never evaluated, so they do not turn into unused variables */
+#define _PCQ_UNUSED(arguments)		do { if (false) { arguments; } } while (0)
+#define PCQ_PROBE2(name, a1, a2)	_PCQ_UNUSED((void) (a1); (void) (a2))
+#define PCQ_PROBE3(name, a1, a2, a3)	_PCQ_UNUSED((void) (a1); (void) (a2); (void) (a3))
+#define PCQ_PROBE2_SEM(name, a1, a2)	_PCQ_UNUSED((void) (a1); (void) (a2))
+#define PCQ_PROBE4_SEM(name, a1, a2, a3, a4)	_PCQ_UNUSED((void) (a1); (void) (a2); (void) (a3); (void) (a4))
+
+#endif
+
+#endif
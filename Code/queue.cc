@@ -0,0 +1,325 @@
+/******************************************************************
+ * The circular queue and its two backings:
+ * initializeQueue - Allocates the ring on the heap or maps the ring file
+ * queue_page_kind - Reports which page size backs the job array
+ * destroyQueue - Releases (or flushes and unmaps) the ring
+ * reconcile_queue - Repairs the element count after a crash
+ * adopt_restored_jobs - Re-stamps the jobs restored from a ring file
+ * next_job_id - Returns the ID (slot + 1) the producer's next job will get
+ * deposit_item - Stores a job at the tail of the queue
+ * fetch_item - Removes the job at the head of the queue
+ *
+ * With fair queueing the job array is split into per-producer
+ * sub-queues managed by fair.cc; count still covers the whole buffer.
+ ******************************************************************/
+
+#include "queue.h"
+#include "fair.h"
+#include "probes.h"
+#include <sys/mman.h>
+
+#define RING_MAGIC		"PCQRING"
+/* Every change to the job record takes a new version: 1 the original job, 2 with
+ * produced_ns, 3 with producer_id, 4 with deadline_ns */
+#define RING_VERSION	4
+#define RING_HEADER_SIZE	4096
+#define HUGE_PAGE_SIZE		(2UL * 1024 * 1024)
+
+/* Layout of the header page of a ring file. The job array starts right after it. */
+struct ring_file_header
+{
+	char magic[8];
+	int version;
+	circular_queue queue; //data is fixed up every time the file is mapped
+};
+
+circular_queue *my_queue = NULL;
+
+static void *ring_mapping = NULL;
+static size_t ring_length = 0;
+
+/* Anonymous mapping used when the job array is placed on huge pages */
+static void *huge_mapping = NULL;
+static size_t huge_length = 0;
+static const char *page_kind = "4 KB pages";
+
+/* Function used to map (and create if needed) the ring file */
+static int map_ring_file(int size, const char *ring_path)
+{
+	struct stat status;
+	bool created;
+
+	int fd = open(ring_path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &status) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	//the job record changes between versions, so the version is checked before the size
+	ring_file_header existing;
+	if (status.st_size >= (off_t) sizeof(existing) && pread(fd, &existing, sizeof(existing), 0) == sizeof(existing)
+		&& memcmp(existing.magic, RING_MAGIC, sizeof(existing.magic)) == 0 && existing.version != RING_VERSION)
+	{
+		cerr << "Ring file '" << ring_path << "' has ring format " << existing.version << ", this build uses " << RING_VERSION << endl;
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	ring_length = RING_HEADER_SIZE + (size_t) size * sizeof(job);
+	created = (status.st_size == 0);
+	if (created && ftruncate(fd, ring_length) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+	else if (!created && (size_t) status.st_size != ring_length)
+	{
+		cerr << "Ring file '" << ring_path << "' was created for a different buffer size" << endl;
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	ring_mapping = mmap(NULL, ring_length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring_mapping == MAP_FAILED)
+	{
+		ring_mapping = NULL;
+		return -1;
+	}
+
+	ring_file_header *header = (ring_file_header *) ring_mapping;
+	if (created)
+	{
+		memcpy(header->magic, RING_MAGIC, sizeof(header->magic));
+		header->version = RING_VERSION;
+		header->queue.head = 0;
+		header->queue.tail = 0;
+		header->queue.count = 0;
+		header->queue.array_size = size;
+	}
+	else if (memcmp(header->magic, RING_MAGIC, sizeof(header->magic)) != 0 || header->version != RING_VERSION
+		|| header->queue.array_size != size)
+	{
+		cerr << "Ring file '" << ring_path << "' is not a valid ring for this buffer size" << endl;
+		munmap(ring_mapping, ring_length);
+		ring_mapping = NULL;
+		errno = EINVAL;
+		return -1;
+	}
+
+	my_queue = &header->queue;
+	my_queue->data = (job *) ((char *) ring_mapping + RING_HEADER_SIZE);
+
+	//consumers and producers walk the ring front to back
+	madvise(my_queue->data, (size_t) size * sizeof(job), MADV_SEQUENTIAL);
+	return 0;
+}
+
+/* Function used to count the transparent huge pages backing a mapping, from /proc/self/smaps */
+static long anon_huge_kb(void *address)
+{
+	char line[256];
+	unsigned long start, end;
+	bool inside = false;
+	long kb = -1;
+
+	FILE *smaps = fopen("/proc/self/smaps", "r");
+	if (smaps == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), smaps) != NULL)
+	{
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2 && strchr(line, '-') < strchr(line, ' '))
+			inside = ((unsigned long) address >= start && (unsigned long) address < end);
+		else if (inside && sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+			break;
+	}
+	fclose(smaps);
+	return kb;
+}
+
+/* Function used to place the job array on 2 MB pages: MAP_HUGETLB first, then
+ * transparent huge pages through madvise. Returns NULL if neither mapping works. */
+static job *allocate_huge(int size)
+{
+	huge_length = ((size_t) size * sizeof(job) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+	huge_mapping = mmap(NULL, huge_length, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (huge_mapping != MAP_FAILED)
+	{
+		page_kind = "2 MB pages (MAP_HUGETLB)";
+		return (job *) huge_mapping;
+	}
+
+	//over-allocate so the array can start on a 2 MB boundary, which THP needs
+	size_t length = huge_length + HUGE_PAGE_SIZE;
+	char *mapping = (char *) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED)
+	{
+		huge_mapping = NULL;
+		return NULL;
+	}
+	char *aligned = (char *) (((unsigned long) mapping + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+	if (aligned > mapping)
+		munmap(mapping, aligned - mapping);
+	if (aligned + huge_length < mapping + length)
+		munmap(aligned + huge_length, mapping + length - (aligned + huge_length));
+	huge_mapping = aligned;
+
+	if (madvise(huge_mapping, huge_length, MADV_HUGEPAGE) != 0)
+	{
+		page_kind = "4 KB pages (MAP_HUGETLB and MADV_HUGEPAGE unavailable)";
+		return (job *) huge_mapping;
+	}
+
+	//fault the array in now so the report reflects what the kernel actually gave us
+	memset(huge_mapping, 0, huge_length);
+	long kb = anon_huge_kb(huge_mapping);
+	if (kb > 0)
+		page_kind = "2 MB transparent huge pages (MADV_HUGEPAGE)";
+	else
+		page_kind = "4 KB pages (MADV_HUGEPAGE requested, no huge pages obtained)";
+	return (job *) huge_mapping;
+}
+
+/* Function used to initialize the circular buffer */
+int initializeQueue(int size, const char *ring_path, bool huge_pages)
+{
+	if (ring_path != NULL)
+		return map_ring_file(size, ring_path);
+
+	my_queue = new circular_queue;
+	my_queue->head = 0;
+	my_queue->tail = 0;
+	my_queue->count = 0;
+	my_queue->array_size = size;
+	page_kind = "4 KB pages";
+	if (huge_pages)
+	{
+		if ((my_queue->data = allocate_huge(size)) == NULL)
+		{
+			delete my_queue;
+			my_queue = NULL;
+			return -1;
+		}
+	}
+	else
+		my_queue->data = new job[size];
+	return 0;
+}
+
+const char *queue_page_kind()
+{
+	return page_kind;
+}
+
+/* Function used to release the circular buffer */
+void destroyQueue()
+{
+	if (ring_mapping != NULL)
+	{
+		msync(ring_mapping, ring_length, MS_SYNC);
+		munmap(ring_mapping, ring_length);
+		ring_mapping = NULL;
+	}
+	else if (my_queue != NULL)
+	{
+		if (huge_mapping != NULL)
+			munmap(huge_mapping, huge_length);
+		else
+			delete [] my_queue->data;
+		delete my_queue;
+	}
+	huge_mapping = NULL;
+	my_queue = NULL;
+}
+
+/* Function used to make count agree with head and tail again. deposit_item and
+ * fetch_item move tail/head before count, so a process that died in between
+ * leaves count one behind. Returns the number of jobs the count was off by. */
+int reconcile_queue()
+{
+	int size = my_queue->array_size;
+	int derived = (my_queue->tail - my_queue->head + size) % size;
+	int count = my_queue->count;
+
+	if (count >= 0 && count <= size && derived == count % size)
+		return 0;
+
+	//head == tail means either empty or full: pick the one closest to the stale count
+	if (derived == 0)
+		my_queue->count = (count > size / 2) ? size : 0;
+	else
+		my_queue->count = derived;
+
+	return abs(my_queue->count - count);
+}
+
+/* Restored jobs were stamped with the previous process's monotonic clock and their
+ * producers are gone, so they are taken over as produced now, with no deadline and
+ * nobody to answer. Returns the largest restored sequence number (0 if none). */
+unsigned long adopt_restored_jobs(long long now)
+{
+	unsigned long largest = 0;
+
+	for (int i = 0; i < my_queue->count; i++)
+	{
+		job *restored = &my_queue->data[(my_queue->head + i) % my_queue->array_size];
+		restored->produced_ns = now;
+		restored->deadline_ns = 0;
+		restored->producer_id = 0;
+		if (restored->seq > largest)
+			largest = restored->seq;
+	}
+	return largest;
+}
+
+/* Function used to tell which ID the next job of producer_id will be deposited with */
+int next_job_id(int producer_id)
+{
+	if (fair_enabled())
+		return fair_next_slot(producer_id) + 1;
+	return my_queue->tail + 1;
+}
+
+/* Probe fired by fetch_item, whose last argument needs the clock */
+PCQ_PROBE_SEMAPHORE(fetch);
+
+/* Function used to deposit a job in the buffer and incrementing the queue tail */
+void deposit_item(job new_job)
+{
+	if (fair_enabled())
+		fair_deposit(new_job);
+	else
+	{
+		my_queue->data[my_queue->tail] = new_job;
+		my_queue->tail = ((my_queue->tail + 1) % my_queue->array_size);
+	}
+	my_queue->count++;
+	PCQ_PROBE3(deposit, new_job.job_id, new_job.seq, my_queue->count);
+}
+
+/* Function used to fetch a job from the buffer and incrementing the queue head */
+job fetch_item()
+{	
+	job myJob;
+
+	if (fair_enabled())
+		myJob = fair_fetch();
+	else
+	{
+		myJob = my_queue->data[my_queue->head];
+		my_queue->head = ((my_queue->head + 1) % my_queue->array_size);
+	}
+	my_queue->count--;
+	if (PCQ_PROBE_ENABLED(fetch))
+		PCQ_PROBE4_SEM(fetch, myJob.job_id, myJob.seq, my_queue->count, now_ns() - myJob.produced_ns);
+	
+	return myJob;
+}
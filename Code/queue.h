@@ -0,0 +1,47 @@
+/******************************************************************
+ * Header file for the circular queue. The queue is either backed
+ * by the heap or by a memory-mapped ring file whose first page
+ * holds the queue state, so that it survives restarts. Only one
+ * process uses a ring file at a time, since every run creates its
+ * own semaphore set and removes it on exit. The heap backing can
+ * optionally be placed on 2 MB pages.
+ ******************************************************************/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "helper.h"
+
+/* Structure for jobs which are to be inserted in the circular quque */
+struct job
+{
+	int job_id;
+	int duration; //in seconds
+	unsigned long seq; //unique across restarts, used by the journal
+	long long produced_ns; //monotonic time the job was produced
+	int producer_id; //0 for jobs from the journal or the ingestion front-end
+	long long deadline_ns; //monotonic time after which the job is skipped, 0 for none
+};
+
+/* Structure used to implement a circular queue */
+struct circular_queue
+{
+	int head;
+	int tail;
+	int array_size;
+	int count;
+	job *data;
+};
+
+extern circular_queue *my_queue;
+
+int initializeQueue(int size, const char *ring_path, bool huge_pages);
+void destroyQueue();
+const char *queue_page_kind();
+int reconcile_queue();
+unsigned long adopt_restored_jobs(long long now);
+int next_job_id(int producer_id);
+void deposit_item(job new_job);
+job fetch_item();
+
+#endif
@@ -0,0 +1,195 @@
+/******************************************************************
+ * Weighted buffer quotas per producer group:
+ * quota_init - Parses the weights ("3:1:1") and reserves each group's share
+ * quota_reserved - Returns the number of slots reserved for a group
+ * quota_acquire - Claims slots for a group, waiting while it may not have them
+ * quota_release - Returns slots once consumers have freed them
+ *
+ * The quota sits in front of the space semaphore: a producer first
+ * claims a slot here, then takes space and mutex as before, so the
+ * semaphore still bounds the buffer as a whole. Claims are decided
+ * under one lock:
+ *  - within its reservation a group only needs a free slot;
+ *  - beyond it (borrowing) it also needs no other group to be
+ *    waiting within its own reservation, so freed slots go back to
+ *    their owners first.
+ ******************************************************************/
+
+#include "quota.h"
+
+/* State and counters of a producer group */
+struct quota_group_state
+{
+	int weight;
+	int reserved;
+	int used;
+	int owners_waiting; //threads of the group waiting within its reservation
+	long claimed, borrowed, waits, reclaims, timeouts;
+	int peak;
+};
+
+static quota_group_state *groups = NULL;
+static int group_count = 0, total_slots = 0, total_used = 0;
+static pthread_mutex_t quota_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t quota_cond = PTHREAD_COND_INITIALIZER;
+
+int quota_init (int slots, const char *weights)
+{
+	int parsed[64], count = 0, sum = 0;
+	const char *cursor = weights;
+	char *end;
+
+	while (count < 64)
+	{
+		long weight = strtol(cursor, &end, 10);
+		if (end == cursor || weight <= 0)
+			return -1;
+		parsed[count++] = weight;
+		sum += weight;
+		if (*end == '\0')
+			break;
+		if (*end != ':')
+			return -1;
+		cursor = end + 1;
+	}
+	if (slots < count)
+		return -1;
+
+	delete[] groups;
+	groups = new quota_group_state[count]();
+	group_count = count;
+	total_slots = slots;
+
+	//every group keeps at least one slot, the rounding remainder is left unreserved
+	for (int g = 0; g < count; g++)
+	{
+		groups[g].weight = parsed[g];
+		groups[g].reserved = (long) slots * parsed[g] / sum;
+		if (groups[g].reserved == 0)
+			groups[g].reserved = 1;
+	}
+	return 0;
+}
+
+bool quota_enabled ()
+{
+	return groups != NULL;
+}
+
+int quota_group (int producer_id)
+{
+	return producer_id % group_count;
+}
+
+int quota_reserved (int group)
+{
+	return groups[group].reserved;
+}
+
+/* Function used to decide whether a group may claim slots right now, with quota_lock held */
+static bool may_claim (int group, int slots)
+{
+	if (total_used + slots > total_slots)
+		return false;
+	if (groups[group].used + slots <= groups[group].reserved)
+		return true;
+	for (int g = 0; g < group_count; g++)
+		if (g != group && groups[g].owners_waiting > 0)
+			return false;
+	return true;
+}
+
+bool quota_has_room (int group)
+{
+	pthread_mutex_lock(&quota_lock);
+	bool room = may_claim(group, 1);
+	pthread_mutex_unlock(&quota_lock);
+	return room;
+}
+
+int quota_acquire (int group, int slots, int time_delay)
+{
+	quota_group_state *state = &groups[group];
+	struct timespec deadline;
+	bool owner = false, waited = false;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += time_delay;
+
+	pthread_mutex_lock(&quota_lock);
+	while (!may_claim(group, slots))
+	{
+		if (time_delay == 0)
+		{
+			pthread_mutex_unlock(&quota_lock);
+			errno = EAGAIN;
+			return -1;
+		}
+
+		//a group waiting within its share holds back the borrowers
+		if (!owner && state->used + slots <= state->reserved)
+		{
+			owner = true;
+			state->owners_waiting++;
+		}
+		if (!waited)
+		{
+			waited = true;
+			state->waits++;
+		}
+
+		int error = (time_delay < 0) ? pthread_cond_wait(&quota_cond, &quota_lock)
+			: pthread_cond_timedwait(&quota_cond, &quota_lock, &deadline);
+		if (error == ETIMEDOUT && !may_claim(group, slots))
+		{
+			if (owner)
+				state->owners_waiting--;
+			state->timeouts++;
+			pthread_mutex_unlock(&quota_lock);
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+
+	if (owner)
+	{
+		state->owners_waiting--;
+		state->reclaims++;
+	}
+	state->used += slots;
+	total_used += slots;
+	state->claimed += slots;
+	if (state->used > state->reserved)
+		state->borrowed += (state->used - slots >= state->reserved) ? slots : state->used - state->reserved;
+	if (state->used > state->peak)
+		state->peak = state->used;
+	pthread_mutex_unlock(&quota_lock);
+	return 0;
+}
+
+void quota_release (int group, int slots)
+{
+	pthread_mutex_lock(&quota_lock);
+	groups[group].used -= slots;
+	total_used -= slots;
+	pthread_cond_broadcast(&quota_cond);
+	pthread_mutex_unlock(&quota_lock);
+}
+
+void print_quota_statistics ()
+{
+	printf("Quotas: %d groups over %d slots\n", group_count, total_slots);
+	for (int g = 0; g < group_count; g++)
+	{
+		quota_group_state *state = &groups[g];
+		printf("  Group %d: weight %d reserved %d peak %d claimed %ld borrowed %ld waits %ld reclaims %ld timeouts %ld\n",
+			g, state->weight, state->reserved, state->peak, state->claimed, state->borrowed,
+			state->waits, state->reclaims, state->timeouts);
+	}
+}
+
+void quota_destroy ()
+{
+	delete[] groups;
+	groups = NULL;
+}
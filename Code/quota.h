@@ -0,0 +1,25 @@
+/******************************************************************
+ * Header file for multi-tenant quotas. Producers are grouped into
+ * tenants (producer p belongs to group p % groups, so group 0 holds
+ * the journal and the ingestion front-end) and every group has a
+ * weighted share of buffer_size reserved. A group may borrow slots
+ * other groups leave unused; borrowed slots are reclaimed as they
+ * drain, since an owner waiting within its share is served first.
+ ******************************************************************/
+
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include "helper.h"
+
+int quota_init (int slots, const char *weights);
+bool quota_enabled ();
+int quota_group (int producer_id);
+int quota_reserved (int group);
+bool quota_has_room (int group);
+int quota_acquire (int group, int slots, int time_delay);
+void quota_release (int group, int slots);
+void print_quota_statistics ();
+void quota_destroy ();
+
+#endif
@@ -0,0 +1,214 @@
+/******************************************************************
+ * The per-producer result rings:
+ * results_init - Allocates one ring per producer
+ * results_post - Publishes a result (any consumer, lock-free)
+ * results_wait - Takes the next result, waiting up to timeout_ms
+ * results_await - Waits for the result of one job, parking the others
+ *
+ * A ring has a power-of-two number of slots, each stamped with the
+ * cursor value it is next valid for: a consumer may only claim the
+ * write cursor once the slot it maps to has been handed back by the
+ * reader, so a full ring makes consumers back off until the producer
+ * catches up (or RESULT_FULL_WAIT_MS passes and the result is counted
+ * as lost). The single reader consumes slots in order and re-stamps
+ * each one for the next lap. The mutex/condvar pair is only used when
+ * the producer has to sleep.
+ ******************************************************************/
+
+#include "results.h"
+#include <deque>
+
+#define RESULT_FULL_WAIT_MS 60000
+
+struct result_slot
+{
+	job_result result;
+	long stamp;	//write cursor it can be claimed at, or read cursor + 1 once published
+};
+
+struct result_ring
+{
+	long write_cursor;	//claimed by consumers
+	char pad[64 - sizeof(long)];
+	long read_cursor;	//owned by the producer
+	int waiting;
+	long mask;	//slots - 1, the number of slots is a power of two
+	result_slot *slots;
+	deque<job_result> parked;	//results taken by results_await while looking for another job
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} __attribute__((aligned(64)));
+
+static result_ring *rings = NULL;
+static int ring_count = 0;
+static long lost = 0;
+
+int results_init (int producers, long capacity)
+{
+	pthread_condattr_t attributes;
+	long slots = 2;	//with one slot a published result would already look free for the next lap
+
+	while (slots < capacity)
+		slots <<= 1;
+
+	ring_count = producers;
+	rings = new result_ring[producers];
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	for (int i = 0; i < producers; i++)
+	{
+		rings[i].write_cursor = rings[i].read_cursor = 0;
+		rings[i].waiting = 0;
+		rings[i].mask = slots - 1;
+		rings[i].slots = new result_slot[slots]();
+		for (long j = 0; j < slots; j++)
+			rings[i].slots[j].stamp = j;
+		pthread_mutex_init(&rings[i].lock, NULL);
+		pthread_cond_init(&rings[i].cond, &attributes);
+	}
+	pthread_condattr_destroy(&attributes);
+	return 0;
+}
+
+void results_post (int producer_id, const job_result *result)
+{
+	//jobs from the journal or the ingestion front-end have no producer to answer
+	if (producer_id < 1 || producer_id > ring_count)
+		return;
+
+	result_ring *ring = &rings[producer_id - 1];
+	long long give_up = now_ns() + RESULT_FULL_WAIT_MS * 1000000LL;
+	long index = __atomic_load_n(&ring->write_cursor, __ATOMIC_RELAXED);
+	result_slot *slot;
+
+	for (;;)
+	{
+		slot = &ring->slots[index & ring->mask];
+		long stamp = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+		if (stamp == index)
+		{
+			//the slot is free for this lap, claim the cursor before writing it
+			if (__atomic_compare_exchange_n(&ring->write_cursor, &index, index + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (stamp < index)
+		{
+			//the ring is full: wait for the producer to take results
+			if (now_ns() >= give_up)
+			{
+				__sync_fetch_and_add(&lost, 1);
+				return;
+			}
+			usleep(1000);
+			index = __atomic_load_n(&ring->write_cursor, __ATOMIC_RELAXED);
+		}
+		else
+			index = __atomic_load_n(&ring->write_cursor, __ATOMIC_RELAXED);
+	}
+	slot->result = *result;
+	__atomic_store_n(&slot->stamp, index + 1, __ATOMIC_SEQ_CST);
+
+	//only wake the producer if it announced it is about to sleep
+	if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&ring->lock);
+		pthread_cond_signal(&ring->cond);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
+
+/* Takes the next result published in the ring itself, waiting up to timeout_ms (0 polls) */
+static int ring_take (result_ring *ring, job_result *result, int timeout_ms)
+{
+	result_slot *slot = &ring->slots[ring->read_cursor & ring->mask];
+	long published = ring->read_cursor + 1;
+	struct timespec deadline;
+	int status = 0;
+
+	if (__atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE) != published)
+	{
+		if (timeout_ms <= 0)
+			return -1;
+
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		//announce the sleep before the final check, consumers test waiting after publishing
+		pthread_mutex_lock(&ring->lock);
+		__atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&slot->stamp, __ATOMIC_SEQ_CST) != published && status != ETIMEDOUT)
+			status = pthread_cond_timedwait(&ring->cond, &ring->lock, &deadline);
+		__atomic_store_n(&ring->waiting, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&ring->lock);
+
+		if (__atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE) != published)
+			return -1;
+	}
+
+	//hand the slot back for the next lap
+	*result = slot->result;
+	__atomic_store_n(&slot->stamp, ring->read_cursor + ring->mask + 1, __ATOMIC_RELEASE);
+	ring->read_cursor++;
+	return 0;
+}
+
+int results_wait (int producer_id, job_result *result, int timeout_ms)
+{
+	result_ring *ring = &rings[producer_id - 1];
+
+	if (!ring->parked.empty())
+	{
+		*result = ring->parked.front();
+		ring->parked.pop_front();
+		return 0;
+	}
+	return ring_take(ring, result, timeout_ms);
+}
+
+int results_await (int producer_id, unsigned long seq, job_result *result, int timeout_ms)
+{
+	result_ring *ring = &rings[producer_id - 1];
+	long long deadline = now_ns() + timeout_ms * 1000000LL;
+
+	for (deque<job_result>::iterator parked = ring->parked.begin(); parked != ring->parked.end(); ++parked)
+		if (parked->seq == seq)
+		{
+			*result = *parked;
+			ring->parked.erase(parked);
+			return 0;
+		}
+
+	//results of other jobs arriving first are parked for results_wait
+	for (;;)
+	{
+		long long left_ms = (deadline - now_ns()) / 1000000;
+		if (left_ms <= 0 || ring_take(ring, result, (int) left_ms) != 0)
+			return -1;
+		if (result->seq == seq)
+			return 0;
+		ring->parked.push_back(*result);
+	}
+}
+
+long results_lost ()
+{
+	return lost;
+}
+
+void results_destroy ()
+{
+	for (int i = 0; i < ring_count; i++)
+	{
+		delete [] rings[i].slots;
+		pthread_mutex_destroy(&rings[i].lock);
+		pthread_cond_destroy(&rings[i].cond);
+	}
+	delete [] rings;
+	rings = NULL;
+}
@@ -0,0 +1,36 @@
+/******************************************************************
+ * Header file for the completion path. Every producer owns a result
+ * ring that consumers publish into once they finish one of its jobs;
+ * the producer polls it, waits on it, or awaits the result of one
+ * particular job (a future keyed by the job's sequence number).
+ ******************************************************************/
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include "helper.h"
+
+#define RESULT_COMPLETED	0
+#define RESULT_EVICTED		1	//overwritten by drop-oldest before it ran
+#define RESULT_CANCELLED	2	//skipped by the consumer, cancelled while queued
+#define RESULT_EXPIRED		3	//skipped by the consumer, past its deadline
+
+/* Structure returned to the producer of a job */
+struct job_result
+{
+	unsigned long seq;
+	int job_id;
+	int consumer_id;
+	int status;
+	long long produced_ns;
+	long long completed_ns;
+};
+
+int results_init (int producers, long capacity);
+void results_post (int producer_id, const job_result *result);
+int results_wait (int producer_id, job_result *result, int timeout_ms);
+int results_await (int producer_id, unsigned long seq, job_result *result, int timeout_ms);
+long results_lost ();
+void results_destroy ();
+
+#endif
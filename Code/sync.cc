@@ -0,0 +1,617 @@
+/******************************************************************
+ * The synchronization backends:
+ * sysv - The original SysV semaphore set (one system call per operation)
+ * posix - Unnamed sem_t semaphores, process-shared, in a shared mapping
+ * condvar - Counters protected by a pthread mutex with a condvar per counter
+ * futex - Atomic counters which only enter the kernel to sleep or wake
+ * eventfd - One EFD_SEMAPHORE eventfd per counter, usable from epoll
+ *
+ * Only the sysv and condvar backends apply several operations atomically;
+ * posix, futex and eventfd apply them in order and roll back on failure, which gives
+ * the same ordering as separate sem_wait calls.
+ ******************************************************************/
+
+#include "sync.h"
+#include "probes.h"
+#include "lockprof.h"
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+/* Absolute CLOCK_MONOTONIC deadline for a delay in seconds. Operations that never
+ * block or block forever do not use it, so the clock is only read for a real delay. */
+static struct timespec deadline_after (int time_delay)
+{
+	struct timespec deadline = { 0, 0 };
+	if (time_delay <= 0)
+		return deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += time_delay;
+	return deadline;
+}
+
+/* ---------------- SysV ---------------- */
+
+static int sysv_id = -1;
+
+/* Without a key path every run gets a private set, which only its own threads can
+ * reach. With a path (e.g. a shared ring file) the key is ftok(path, instance). */
+static const char *sysv_key_path = NULL;
+static int sysv_instance = 0;
+
+static int sysv_create (int count)
+{
+	if (sysv_key_path == NULL)
+	{
+		//private sets of instances that died can only be found by listing every set
+		int reclaimed = sem_reclaim_stale_private();
+		if (reclaimed > 0)
+			cerr << "Reclaimed " << reclaimed << " stale private semaphore set(s)" << endl;
+		return ((sysv_id = sem_create_private(count)) < 0) ? -1 : 0;
+	}
+
+	key_t key = sem_instance_key(sysv_key_path, sysv_instance);
+	if (key == -1)
+		return -1;
+	if ((sysv_id = sem_create(key, count)) >= 0)
+		return 0;
+
+	//a set left behind by an instance that died is reclaimed, a live one is not touched
+	if (errno != EEXIST)
+		return -1;
+	int reclaimed = sem_reclaim_stale(key);
+	if (reclaimed != 1)
+	{
+		//a failed check keeps its own errno, a live set is reported as existing
+		if (reclaimed == 0)
+			errno = EEXIST;
+		return -1;
+	}
+	cerr << "Reclaimed a stale semaphore set for key 0x" << hex << key << dec << endl;
+	sysv_id = sem_create(key, count);
+	return (sysv_id < 0) ? -1 : 0;
+}
+
+static int sysv_set_value (int num, int value)
+{
+	return sem_init(sysv_id, num, value);
+}
+
+static int sysv_get_value (int num)
+{
+	return sem_get_value(sysv_id, num);
+}
+
+static int sysv_op_many (const sem_op_entry *ops, int count, int time_delay)
+{
+	return sem_op_many(sysv_id, ops, count, time_delay);
+}
+
+static void sysv_destroy ()
+{
+	sem_close(sysv_id);
+}
+
+/* ---------------- POSIX sem_t ---------------- */
+
+static sem_t *posix_sems = NULL;
+static int posix_count = 0;
+
+static int posix_create (int count)
+{
+	posix_sems = (sem_t *) mmap(NULL, count * sizeof(sem_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (posix_sems == MAP_FAILED)
+	{
+		posix_sems = NULL;
+		return -1;
+	}
+	posix_count = count;
+	for (int i = 0; i < count; i++)
+		if (sem_init(&posix_sems[i], 1, 0) != 0)
+			return -1;
+	return 0;
+}
+
+static int posix_set_value (int num, int value)
+{
+	sem_destroy(&posix_sems[num]);
+	return sem_init(&posix_sems[num], 1, value);
+}
+
+static int posix_get_value (int num)
+{
+	int value;
+	if (sem_getvalue(&posix_sems[num], &value) != 0)
+		return -1;
+	return value;
+}
+
+/* Applies a single down () on a sem_t honouring the sem_op_many delay convention */
+static int posix_down (sem_t *sem, int time_delay, struct timespec *deadline)
+{
+	int result;
+	if (time_delay == 0)
+		return sem_trywait(sem);
+	do
+		result = (time_delay < 0) ? sem_wait(sem) : sem_clockwait(sem, CLOCK_MONOTONIC, deadline);
+	while (result != 0 && errno == EINTR);
+	return result;
+}
+
+static int posix_op_many (const sem_op_entry *ops, int count, int time_delay)
+{
+	struct timespec deadline = deadline_after(time_delay);
+
+	for (int i = 0; i < count; i++)
+	{
+		sem_t *sem = &posix_sems[ops[i].num];
+		for (int unit = 0; unit < ops[i].delta; unit++)
+			sem_post(sem);
+		for (int unit = 0; unit < -ops[i].delta; unit++)
+		{
+			if (posix_down(sem, time_delay, &deadline) == 0)
+				continue;
+
+			//give back everything taken so far, then report the failure
+			int error = (errno == ETIMEDOUT) ? EAGAIN : errno;
+			for (int taken = 0; taken < unit; taken++)
+				sem_post(sem);
+			for (int j = i - 1; j >= 0; j--)
+				for (int back = 0; back < -ops[j].delta; back++)
+					sem_post(&posix_sems[ops[j].num]);
+			errno = error;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void posix_destroy ()
+{
+	for (int i = 0; i < posix_count; i++)
+		sem_destroy(&posix_sems[i]);
+	munmap(posix_sems, posix_count * sizeof(sem_t));
+	posix_sems = NULL;
+}
+
+/* ---------------- pthread mutex + condvar ---------------- */
+
+static pthread_mutex_t condvar_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t *condvar_conds = NULL;
+static int *condvar_values = NULL;
+static int condvar_count = 0;
+
+static int condvar_create (int count)
+{
+	pthread_condattr_t attributes;
+
+	condvar_count = count;
+	condvar_values = new int[count]();
+	condvar_conds = new pthread_cond_t[count];
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	for (int i = 0; i < count; i++)
+		pthread_cond_init(&condvar_conds[i], &attributes);
+	pthread_condattr_destroy(&attributes);
+	return 0;
+}
+
+static int condvar_set_value (int num, int value)
+{
+	pthread_mutex_lock(&condvar_lock);
+	condvar_values[num] = value;
+	pthread_cond_broadcast(&condvar_conds[num]);
+	pthread_mutex_unlock(&condvar_lock);
+	return 0;
+}
+
+static int condvar_get_value (int num)
+{
+	pthread_mutex_lock(&condvar_lock);
+	int value = condvar_values[num];
+	pthread_mutex_unlock(&condvar_lock);
+	return value;
+}
+
+/* All operations are applied together once every decrement can be satisfied */
+static int condvar_op_many (const sem_op_entry *ops, int count, int time_delay)
+{
+	struct timespec deadline = deadline_after(time_delay);
+
+	pthread_mutex_lock(&condvar_lock);
+	for (;;)
+	{
+		int blocked = -1;
+		for (int i = 0; i < count && blocked < 0; i++)
+			if (ops[i].delta < 0 && condvar_values[ops[i].num] < -ops[i].delta)
+				blocked = ops[i].num;
+		if (blocked < 0)
+			break;
+
+		int result = 0;
+		if (time_delay == 0)
+			result = EAGAIN;
+		else if (time_delay < 0)
+			pthread_cond_wait(&condvar_conds[blocked], &condvar_lock);
+		else
+			result = pthread_cond_timedwait(&condvar_conds[blocked], &condvar_lock, &deadline);
+		if (result != 0)
+		{
+			pthread_mutex_unlock(&condvar_lock);
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		condvar_values[ops[i].num] += ops[i].delta;
+		//waiters may need several units or other counters too, so all of them recheck
+		if (ops[i].delta > 0)
+			pthread_cond_broadcast(&condvar_conds[ops[i].num]);
+	}
+	pthread_mutex_unlock(&condvar_lock);
+	return 0;
+}
+
+static void condvar_destroy ()
+{
+	for (int i = 0; i < condvar_count; i++)
+		pthread_cond_destroy(&condvar_conds[i]);
+	delete [] condvar_conds;
+	delete [] condvar_values;
+}
+
+/* ---------------- futex ---------------- */
+
+/* Each counter sits on its own cache line together with the number of sleepers */
+struct futex_counter
+{
+	int value;
+	int waiters;
+} __attribute__((aligned(64)));
+
+static futex_counter *futex_counters = NULL;
+
+static int futex_create (int count)
+{
+	futex_counters = new futex_counter[count]();
+	return 0;
+}
+
+static int futex_set_value (int num, int value)
+{
+	__atomic_store_n(&futex_counters[num].value, value, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, &futex_counters[num].value, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	return 0;
+}
+
+static int futex_get_value (int num)
+{
+	return __atomic_load_n(&futex_counters[num].value, __ATOMIC_SEQ_CST);
+}
+
+static int futex_down (futex_counter *counter, int units, int time_delay, struct timespec *deadline)
+{
+	for (;;)
+	{
+		int value = __atomic_load_n(&counter->value, __ATOMIC_ACQUIRE);
+		if (value >= units)
+		{
+			if (__atomic_compare_exchange_n(&counter->value, &value, value - units, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				return 0;
+			continue;
+		}
+		if (time_delay == 0)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+
+		//sleep only while the value is still the one we saw
+		__atomic_fetch_add(&counter->waiters, 1, __ATOMIC_SEQ_CST);
+		long result = syscall(SYS_futex, &counter->value, FUTEX_WAIT_BITSET_PRIVATE, value,
+			time_delay < 0 ? NULL : deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+		__atomic_fetch_sub(&counter->waiters, 1, __ATOMIC_SEQ_CST);
+		if (result != 0 && errno == ETIMEDOUT)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+}
+
+static void futex_up (futex_counter *counter, int units)
+{
+	__atomic_fetch_add(&counter->value, units, __ATOMIC_RELEASE);
+	//waiters may need several units, so all of them recheck
+	if (__atomic_load_n(&counter->waiters, __ATOMIC_SEQ_CST) > 0)
+		syscall(SYS_futex, &counter->value, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static int futex_op_many (const sem_op_entry *ops, int count, int time_delay)
+{
+	struct timespec deadline = deadline_after(time_delay);
+
+	for (int i = 0; i < count; i++)
+	{
+		futex_counter *counter = &futex_counters[ops[i].num];
+		if (ops[i].delta >= 0)
+		{
+			if (ops[i].delta > 0)
+				futex_up(counter, ops[i].delta);
+			continue;
+		}
+		if (futex_down(counter, -ops[i].delta, time_delay, &deadline) != 0)
+		{
+			for (int j = i - 1; j >= 0; j--)
+				if (ops[j].delta < 0)
+					futex_up(&futex_counters[ops[j].num], -ops[j].delta);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void futex_destroy ()
+{
+	delete [] futex_counters;
+}
+
+/* ---------------- eventfd ---------------- */
+
+/* Every counter is an eventfd in semaphore mode: a read takes one unit and
+ * fails with EAGAIN at zero, a write of n adds n units and wakes pollers. */
+static int *eventfd_fds = NULL;
+static int eventfd_count = 0;
+
+static int eventfd_create (int count)
+{
+	eventfd_count = count;
+	eventfd_fds = new int[count];
+	for (int i = 0; i < count; i++)
+		if ((eventfd_fds[i] = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+			return -1;
+	return 0;
+}
+
+/* The counter cannot be overwritten, so it is drained and refilled */
+static int eventfd_set_value (int num, int value)
+{
+	uint64_t unit;
+	while (read(eventfd_fds[num], &unit, sizeof(unit)) == sizeof(unit))
+		;
+	if (value == 0)
+		return 0;
+	unit = value;
+	return (write(eventfd_fds[num], &unit, sizeof(unit)) == sizeof(unit)) ? 0 : -1;
+}
+
+/* The current count is only visible through /proc, which is fine off the hot path */
+static int eventfd_get_value (int num)
+{
+	char path[64], line[128];
+	long long value = -1;
+
+	snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", eventfd_fds[num]);
+	FILE *info = fopen(path, "r");
+	if (info == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), info) != NULL)
+		if (sscanf(line, "eventfd-count: %llx", &value) == 1)
+			break;
+	fclose(info);
+	return (int) value;
+}
+
+static int eventfd_down (int fd, int time_delay, struct timespec *deadline)
+{
+	uint64_t unit;
+	struct pollfd waiter = { fd, POLLIN, 0 };
+
+	for (;;)
+	{
+		if (read(fd, &unit, sizeof(unit)) == sizeof(unit))
+			return 0;
+		if (errno != EAGAIN)
+			return -1;
+		if (time_delay == 0)
+			return -1;
+
+		int timeout_ms = -1;
+		if (time_delay > 0)
+		{
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long long left = (deadline->tv_sec - now.tv_sec) * 1000LL + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+			if (left <= 0)
+			{
+				errno = EAGAIN;
+				return -1;
+			}
+			timeout_ms = (int) left;
+		}
+		poll(&waiter, 1, timeout_ms);
+	}
+}
+
+static void eventfd_up (int fd, int units)
+{
+	uint64_t value = units;
+	if (write(fd, &value, sizeof(value)) != sizeof(value))
+		cerr << "eventfd write failed: " << strerror(errno) << endl;
+}
+
+static int eventfd_op_many (const sem_op_entry *ops, int count, int time_delay)
+{
+	struct timespec deadline = deadline_after(time_delay);
+
+	for (int i = 0; i < count; i++)
+	{
+		int fd = eventfd_fds[ops[i].num];
+		if (ops[i].delta > 0)
+			eventfd_up(fd, ops[i].delta);
+		for (int unit = 0; unit < -ops[i].delta; unit++)
+		{
+			if (eventfd_down(fd, time_delay, &deadline) == 0)
+				continue;
+
+			//give back everything taken so far, then report the failure
+			int error = errno;
+			if (unit > 0)
+				eventfd_up(fd, unit);
+			for (int j = i - 1; j >= 0; j--)
+				if (ops[j].delta < 0)
+					eventfd_up(eventfd_fds[ops[j].num], -ops[j].delta);
+			errno = error;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void eventfd_destroy ()
+{
+	for (int i = 0; i < eventfd_count; i++)
+		close(eventfd_fds[i]);
+	delete [] eventfd_fds;
+	eventfd_fds = NULL;
+}
+
+/* ---------------- selection and wrappers ---------------- */
+
+static sync_backend backends[] = {
+	{ "sysv", sysv_create, sysv_set_value, sysv_get_value, sysv_op_many, sysv_destroy },
+	{ "posix", posix_create, posix_set_value, posix_get_value, posix_op_many, posix_destroy },
+	{ "condvar", condvar_create, condvar_set_value, condvar_get_value, condvar_op_many, condvar_destroy },
+	{ "futex", futex_create, futex_set_value, futex_get_value, futex_op_many, futex_destroy },
+	{ "eventfd", eventfd_create, eventfd_set_value, eventfd_get_value, eventfd_op_many, eventfd_destroy },
+};
+
+sync_backend *sync_ops = &backends[0];
+
+int sync_select (const char *name)
+{
+	for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+		if (strcmp(backends[i].name, name) == 0)
+		{
+			sync_ops = &backends[i];
+			return 0;
+		}
+	return -1;
+}
+
+void sync_set_key (const char *path, int instance)
+{
+	sysv_key_path = path;
+	sysv_instance = instance;
+}
+
+const char *sync_backend_names ()
+{
+	return "sysv, posix, condvar, futex, eventfd";
+}
+
+int sync_create (int count)
+{
+	return sync_ops->create(count);
+}
+
+int sync_init (int num, int value)
+{
+	return sync_ops->set_value(num, value);
+}
+
+int sync_get_value (int num)
+{
+	return sync_ops->get_value(num);
+}
+
+/* Probes on the wait points. The ones reporting how long the wait took only read
+ * the clock while a tool is attached. Operations with a deadline also fire
+ * sem_timed_wait. */
+PCQ_PROBE_SEMAPHORE(sem_op);
+PCQ_PROBE_SEMAPHORE(sem_wait);
+PCQ_PROBE_SEMAPHORE(sem_timed_wait);
+
+int sync_op_many (const sem_op_entry *ops, int count, int time_delay)
+{
+	//the profiler takes the mutex try-then-wait and charges it to the caller's site
+	if (lock_profile_on && lock_profile_watches(ops, count))
+		return lock_profile_op_many(ops, count, time_delay);
+	bool timed = (time_delay > 0 && PCQ_PROBE_ENABLED(sem_timed_wait));
+	if (!PCQ_PROBE_ENABLED(sem_op) && !timed)
+		return sync_ops->op_many(ops, count, time_delay);
+
+	long long started = now_ns();
+	int result = sync_ops->op_many(ops, count, time_delay);
+	long long waited = now_ns() - started;
+	PCQ_PROBE4_SEM(sem_op, ops[0].num, count, waited, result);
+	if (timed)
+		PCQ_PROBE4_SEM(sem_timed_wait, ops[0].num, time_delay, waited, result);
+	return result;
+}
+
+void sync_wait (int num)
+{
+	sem_op_entry op = { (short unsigned int) num, -1 };
+	if (lock_profile_on && lock_profile_watches(&op, 1))
+	{
+		lock_profile_op_many(&op, 1, -1);
+		return;
+	}
+	if (!PCQ_PROBE_ENABLED(sem_wait))
+	{
+		sync_ops->op_many(&op, 1, -1);
+		return;
+	}
+
+	long long started = now_ns();
+	sync_ops->op_many(&op, 1, -1);
+	PCQ_PROBE2_SEM(sem_wait, num, now_ns() - started);
+}
+
+void sync_signal (int num)
+{
+	sem_op_entry op = { (short unsigned int) num, 1 };
+	if (lock_profile_on && lock_profile_watches(&op, 1))
+		lock_profile_op_many(&op, 1, -1);
+	else
+		sync_ops->op_many(&op, 1, -1);
+	PCQ_PROBE2(sem_signal, num, 1);
+}
+
+int sync_try_wait (int num)
+{
+	sem_op_entry op = { (short unsigned int) num, -1 };
+	return sync_ops->op_many(&op, 1, 0);
+}
+
+void sync_close ()
+{
+	sync_ops->destroy();
+}
+
+/* Descriptor that is readable while semaphore num is non-zero, or -1 if the
+ * backend has none. Reading it takes a unit, so waiters should only poll it and
+ * then claim the unit through sync_try_wait. */
+int sync_event_fd (int num)
+{
+	if (sync_ops->create != eventfd_create || eventfd_fds == NULL)
+		return -1;
+	return eventfd_fds[num];
+}
+
+void print_sync_error (int error, bool creating)
+{
+	if (sync_ops != &backends[0])
+		cerr << "The " << sync_ops->name << " synchronization backend failed: " << strerror(error) << endl;
+	else if (creating)
+		print_semget_error(error);
+	else
+		print_semctl_error(error);
+}
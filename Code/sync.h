@@ -0,0 +1,44 @@
+/******************************************************************
+ * Header file for the synchronization backends. Every backend
+ * provides a set of counting semaphores with the same operations
+ * as helper.cc's SysV functions, so the producers and consumers
+ * do not depend on how the semaphores are implemented. The backend
+ * is chosen at runtime with sync_select. The eventfd backend also
+ * exposes each semaphore as a file descriptor that can be added to
+ * an epoll set (readable while the count is non-zero).
+ ******************************************************************/
+
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "helper.h"
+
+/* Table of operations implemented by each backend. time_delay follows
+ * sem_op_many: seconds, negative blocks forever, 0 never blocks. */
+struct sync_backend
+{
+	const char *name;
+	int (*create) (int count);
+	int (*set_value) (int num, int value);
+	int (*get_value) (int num);
+	int (*op_many) (const sem_op_entry *ops, int count, int time_delay);
+	void (*destroy) ();
+};
+
+extern sync_backend *sync_ops;
+
+int sync_select (const char *name);
+void sync_set_key (const char *path, int instance);
+const char *sync_backend_names ();
+int sync_create (int count);
+int sync_init (int num, int value);
+int sync_get_value (int num);
+int sync_op_many (const sem_op_entry *ops, int count, int time_delay);
+void sync_wait (int num);
+void sync_signal (int num);
+int sync_try_wait (int num);
+void sync_close ();
+int sync_event_fd (int num);
+void print_sync_error (int error, bool creating);
+
+#endif
@@ -0,0 +1,117 @@
+/******************************************************************
+ * The timeline recorder:
+ * timeline_start - Allocates a span buffer per thread
+ * timeline_register - Gives the calling thread its own buffer
+ * timeline_record - Appends a span to the calling thread's buffer
+ * timeline_dump - Writes every buffer as Chrome trace JSON
+ *
+ * Buffers are fixed-size so recording never allocates; spans that
+ * do not fit are counted as dropped and reported in the trace.
+ ******************************************************************/
+
+#include "timeline.h"
+
+__thread timeline_buffer *local_timeline = NULL;
+bool timeline_on = false;
+
+static timeline_buffer *buffers = NULL;
+static int buffer_count = 0, buffer_capacity = 0;
+static long event_capacity = 0;
+static const char *timeline_path = NULL;
+static long long origin_ns = 0;
+
+int timeline_start (const char *path, int max_threads, long events_per_thread)
+{
+	//fail early on a path that cannot be written
+	FILE *out = fopen(path, "w");
+	if (out == NULL)
+		return -1;
+	fclose(out);
+
+	buffers = new timeline_buffer[max_threads]();
+	buffer_capacity = max_threads;
+	event_capacity = events_per_thread;
+	timeline_path = path;
+	origin_ns = now_ns();
+	timeline_on = true;
+	return 0;
+}
+
+void timeline_register (const char *role, int id)
+{
+	if (!timeline_on)
+		return;
+
+	//a consumer started in the slot of one that left appends to the same buffer
+	int count = (buffer_count < buffer_capacity) ? buffer_count : buffer_capacity;
+	for (int i = 0; i < count; i++)
+		if (buffers[i].role != NULL && buffers[i].id == id && strcmp(buffers[i].role, role) == 0)
+		{
+			local_timeline = &buffers[i];
+			return;
+		}
+
+	int index = __sync_fetch_and_add(&buffer_count, 1);
+	if (index >= buffer_capacity)
+		return;
+	buffers[index].role = role;
+	buffers[index].id = id;
+	buffers[index].events = new timeline_event[event_capacity];
+	local_timeline = &buffers[index];
+}
+
+void timeline_record (const char *name, long long begin_ns, long long end_ns)
+{
+	timeline_buffer *own = local_timeline;
+
+	if (own->count == event_capacity)
+	{
+		own->dropped++;
+		return;
+	}
+	own->events[own->count].name = name;
+	own->events[own->count].begin_ns = begin_ns;
+	own->events[own->count].end_ns = end_ns;
+	own->count++;
+}
+
+int timeline_dump ()
+{
+	if (!timeline_on)
+		return 0;
+
+	FILE *out = fopen(timeline_path, "w");
+	if (out == NULL)
+		return -1;
+
+	int count = (buffer_count < buffer_capacity) ? buffer_count : buffer_capacity;
+	long written = 0, dropped = 0;
+	int pid = getpid();
+
+	//one metadata event names each track, then every span is a complete ("X") event
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(out, "{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":\"producer-consumer\"}}", pid);
+	for (int t = 0; t < count; t++)
+	{
+		timeline_buffer *buffer = &buffers[t];
+		fprintf(out, ",\n{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s %d\"}}",
+			pid, t + 1, buffer->role, buffer->id);
+		for (long e = 0; e < buffer->count; e++)
+		{
+			timeline_event *event = &buffer->events[e];
+			fprintf(out, ",\n{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}",
+				pid, t + 1, event->name, (event->begin_ns - origin_ns) / 1000.0, (event->end_ns - event->begin_ns) / 1000.0);
+		}
+		written += buffer->count;
+		dropped += buffer->dropped;
+		delete[] buffer->events;
+	}
+	fprintf(out, "\n],\"otherData\":{\"dropped_events\":%ld}}\n", dropped);
+	fclose(out);
+
+	printf("Timeline: %ld spans from %d threads written to %s (%ld dropped)\n", written, count, timeline_path, dropped);
+	delete[] buffers;
+	buffers = NULL;
+	timeline_on = false;
+	return 0;
+}
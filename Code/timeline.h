@@ -0,0 +1,47 @@
+/******************************************************************
+ * Header file for timeline tracing. Threads record spans (produce,
+ * wait-space, wait-mutex, deposit, wait-item, fetch, execute) into
+ * buffers of their own, without locks, and the buffers are written
+ * out at exit as a Chrome trace (JSON) that chrome://tracing and
+ * Perfetto can display, one track per thread.
+ ******************************************************************/
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include "helper.h"
+
+/* A finished span of one thread */
+struct timeline_event
+{
+	const char *name;
+	long long begin_ns;
+	long long end_ns;
+};
+
+/* Span buffer of one thread */
+struct timeline_buffer
+{
+	const char *role;
+	int id;
+	timeline_event *events;
+	long count;
+	long dropped;
+} __attribute__((aligned(64)));
+
+extern __thread timeline_buffer *local_timeline;
+extern bool timeline_on;
+
+int timeline_start (const char *path, int max_threads, long events_per_thread);
+void timeline_register (const char *role, int id);
+void timeline_record (const char *name, long long begin_ns, long long end_ns);
+int timeline_dump ();
+
+/* Function used to close a span opened at begin_ns (0 when tracing was off at the time) */
+static inline void timeline_span (const char *name, long long begin_ns)
+{
+	if (begin_ns != 0 && local_timeline != NULL)
+		timeline_record(name, begin_ns, now_ns());
+}
+
+#endif
@@ -0,0 +1,123 @@
+/******************************************************************
+ * Recording and replay of job streams:
+ * trace_start - Fixes the time origin of the recorded and replayed streams
+ * trace_record_open - Creates a trace file and writes its header
+ * trace_record_job - Appends one produced job to the trace
+ * trace_replay_open - Loads a trace and splits it per producer
+ * trace_replay_jobs - Number of jobs a producer has to replay
+ * trace_replay_job - Duration and scaled arrival time of a replayed job
+ ******************************************************************/
+
+#include "trace.h"
+#include <vector>
+
+static long long trace_origin_ns = 0;
+
+static FILE *record_file = NULL;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+static long records_recorded = 0;
+
+static vector< vector<trace_record> > replay_jobs;
+static double replay_speed = 1.0;
+
+void trace_start (long long start_ns)
+{
+	trace_origin_ns = start_ns;
+}
+
+int trace_record_open (const char *path)
+{
+	int version = TRACE_VERSION;
+
+	if ((record_file = fopen(path, "wb")) == NULL)
+		return -1;
+	//a large stdio buffer keeps recording off the producers' critical path
+	setvbuf(record_file, NULL, _IOFBF, 1 << 20);
+	fwrite(TRACE_MAGIC, 1, 8, record_file);
+	fwrite(&version, sizeof(version), 1, record_file);
+	return 0;
+}
+
+void trace_record_job (int producer_id, long long produced_ns, int duration)
+{
+	trace_record record;
+
+	if (record_file == NULL)
+		return;
+
+	record.offset_ns = produced_ns - trace_origin_ns;
+	record.producer_id = producer_id;
+	record.duration = duration;
+	record.payload_size = 0;
+
+	pthread_mutex_lock(&record_lock);
+	fwrite(&record, sizeof(record), 1, record_file);
+	records_recorded++;
+	pthread_mutex_unlock(&record_lock);
+}
+
+void trace_record_close ()
+{
+	if (record_file == NULL)
+		return;
+	fclose(record_file);
+	record_file = NULL;
+	printf("Trace: recorded %ld jobs\n", records_recorded);
+}
+
+int trace_replay_open (const char *path, double speed, int producers)
+{
+	char magic[8];
+	int version;
+	trace_record record;
+	long folded = 0;
+
+	if (producers <= 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return -1;
+	if (fread(magic, 1, 8, file) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0
+		|| fread(&version, sizeof(version), 1, file) != 1 || version != TRACE_VERSION)
+	{
+		cerr << "'" << path << "' is not a job trace" << endl;
+		fclose(file);
+		errno = EINVAL;
+		return -1;
+	}
+
+	replay_speed = speed;
+	replay_jobs.assign(producers, vector<trace_record>());
+	while (fread(&record, sizeof(record), 1, file) == 1)
+	{
+		//jobs of producers this run does not have are spread over the existing ones
+		if (record.producer_id < 1 || record.producer_id > producers)
+		{
+			record.producer_id = (record.producer_id > 0 ? record.producer_id - 1 : 0) % producers + 1;
+			folded++;
+		}
+		replay_jobs[record.producer_id - 1].push_back(record);
+	}
+	fclose(file);
+
+	if (folded > 0)
+		cerr << "Trace: " << folded << " jobs belonged to producers beyond " << producers << " and were reassigned" << endl;
+	return 0;
+}
+
+long trace_replay_jobs (int producer_id)
+{
+	return replay_jobs[producer_id - 1].size();
+}
+
+void trace_replay_job (int producer_id, long index, int *duration, long long *arrival_ns)
+{
+	trace_record &record = replay_jobs[producer_id - 1][index];
+
+	*duration = record.duration;
+	*arrival_ns = trace_origin_ns + (long long) (record.offset_ns / replay_speed);
+}
@@ -0,0 +1,33 @@
+/******************************************************************
+ * Header file for job stream traces. The recorder writes every
+ * produced job to a compact binary file; the replayer feeds the
+ * same stream back through the producers at the original speed
+ * or scaled by a factor.
+ ******************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "helper.h"
+
+#define TRACE_MAGIC		"PCQTRACE"
+#define TRACE_VERSION	1
+
+/* Structure of one job in a trace file, following an 8 byte magic and a version */
+struct trace_record
+{
+	long long offset_ns;	//production time relative to the start of the run
+	int producer_id;
+	int duration;
+	int payload_size;		//jobs carry no payload yet, always 0
+} __attribute__((packed));
+
+void trace_start (long long start_ns);
+int trace_record_open (const char *path);
+void trace_record_job (int producer_id, long long produced_ns, int duration);
+void trace_record_close ();
+int trace_replay_open (const char *path, double speed, int producers);
+long trace_replay_jobs (int producer_id);
+void trace_replay_job (int producer_id, long index, int *duration, long long *arrival_ns);
+
+#endif